@@ -88,7 +88,7 @@ void ImageWidget::draw()
     rgb = m_pImage->To_RGB(); // Convert the pre-multiplied RGBA image into RGB.
     unsigned int imageX = x() + (w() > m_pImage->width) ? (w() - m_pImage->width) / 2 : 0;
     fl_draw_image(rgb, imageX, y() + c_border * 2 + c_buttonHeight, m_pImage->width, m_pImage->height, 3);
-    delete[] rgb;
+    TargaImage::Free_Pixels(rgb);
 }// draw
 
 
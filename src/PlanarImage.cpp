@@ -0,0 +1,403 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PlanarImage.cpp
+//
+//      Implementation of PlanarImage methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "PlanarImage.h"
+#include "TargaImage.h"
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+// plane rows are padded to a multiple of this many bytes, a cache line
+const size_t    c_rowBytes              = 64;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      What a channel of type T holds:  One is the value a byte's 1 maps
+//  to, and Put brings a filtered sum back into the channel.  Sums are
+//  always taken in float.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class T> struct Channel;
+
+template <> struct Channel<float>
+{
+	static float One() { return 1; }
+	static float Put(float v, bool bClamp) { return !bClamp ? v : v < 0 ? 0 : v > 255 ? 255 : v; }
+};
+
+template <> struct Channel<unsigned short>
+{
+	static float One() { return 257; }
+	static unsigned short Put(float v, bool) { v += 0.5f; return v <= 0 ? 0 : v >= 65535 ? 65535 : (unsigned short)v; }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make planes of the given depth for image.  Returns NULL for depths
+//  there's no channel type for.
+//
+///////////////////////////////////////////////////////////////////////////////
+PlanarImage* PlanarImage::Create(const TargaImage& image, int depth)
+{
+	switch (depth)
+	{
+		case 16:
+			return new PlanarImageOf<unsigned short>(image);
+		case 32:
+			return new PlanarImageOf<float>(image);
+		default:
+			return NULL;
+	}
+}// Create
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Split image's pixels into planes.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class T>
+PlanarImageOf<T>::PlanarImageOf(const TargaImage& image)
+	: block(NULL)
+{
+	Alloc_Planes(image.width, image.height);
+	if (!image.data)
+		return;
+
+	const float one = Channel<T>::One();
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned char* src = image.data + (size_t)y * image.stride;
+		T* r = Row(0, y);
+		T* g = Row(1, y);
+		T* b = Row(2, y);
+		T* a = Row(3, y);
+
+		for (int x = 0; x < width; x++, src += 4)
+		{
+			r[x] = (T)(src[0] * one);
+			g[x] = (T)(src[1] * one);
+			b[x] = (T)(src[2] * one);
+			a[x] = (T)(src[3] * one);
+		}
+	}
+}// PlanarImageOf
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Free image memory.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class T>
+PlanarImageOf<T>::~PlanarImageOf()
+{
+	if (block)
+		TargaImage::Free_Pixels(block);
+}// ~PlanarImageOf
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Give the image room for four w x h planes, each row aligned.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class T>
+void PlanarImageOf<T>::Alloc_Planes(int w, int h)
+{
+	const size_t rowChannels = c_rowBytes / sizeof(T);
+
+	width = w;
+	height = h;
+	depth = sizeof(T) == sizeof(float) ? 32 : sizeof(T) * 8;
+	stride = ((size_t)w + rowChannels - 1) / rowChannels * rowChannels;
+	block = TargaImage::Alloc_Pixels(4 * stride * h * sizeof(T));
+
+	for (int c = 0; c < 4; c++)
+		planes[c] = (T*)block + c * stride * h;
+}// Alloc_Planes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Pack the planes back into image's pixels, rounding each channel to
+//  the nearest byte.  image's pixels must be its own to write.  Its top 
+//  left pixel is column x, row y of the planes; a view's planes reach past
+//  its edges, and only the part under the view is stored.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class T>
+void PlanarImageOf<T>::Store(TargaImage& image, int x, int y) const
+{
+	const float one = Channel<T>::One();
+	for (int i = 0; i < image.height; i++)
+	{
+		unsigned char* dst = image.data + (size_t)i * image.stride;
+		const T* src[4];
+		for (int c = 0; c < 4; c++)
+			src[c] = planes[c] + (size_t)(y + i) * stride + x;
+
+		for (int j = 0; j < image.width; j++, dst += 4)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				float v = src[c][j] / one + 0.5f;
+				dst[c] = v <= 0 ? 0 : v >= 255 ? 255 : (unsigned char)v;
+			}
+		}
+	}
+}// Store
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Start a filter pass:  a block laid out like ours, from the pool, for
+//  the pass to write into while it reads the planes.  dst is set to its 
+//  planes, and alpha, which the filters leave alone, is copied over.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class T>
+unsigned char* PlanarImageOf<T>::Begin_Pass(T* dst[4])
+{
+	unsigned char* next = TargaImage::Alloc_Pixels(4 * stride * height * sizeof(T));
+
+	for (int c = 0; c < 4; c++)
+		dst[c] = (T*)next + c * stride * height;
+	memcpy(dst[3], planes[3], stride * height * sizeof(T));
+
+	return next;
+}// Begin_Pass
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Finish a filter pass:  the block it wrote becomes the planes, and
+//  the old ones go back to the pool for the next pass to take.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class T>
+void PlanarImageOf<T>::End_Pass(unsigned char* next)
+{
+	TargaImage::Free_Pixels(block);
+	block = next;
+
+	for (int c = 0; c < 4; c++)
+		planes[c] = (T*)block + c * stride * height;
+}// End_Pass
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve the color planes with mask.  The mask is size x size, row by
+//  row, centered on the pixel, and pixels outside the image add nothing to
+//  the sum.  Results go to a separate block, so every pixel is filtered 
+//  from the same unfiltered neighbors and the rows could be done in any 
+//  order.  Each row is summed one mask entry at a time over the whole row,
+//  as in Convolve_Separable.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class T>
+void PlanarImageOf<T>::Convolve(const int* mask, int size, int divisor, bool bClamp)
+{
+	const int distance = size / 2;
+	if (!width || !height)
+		return;
+
+	T* dst[4];
+	unsigned char* next = Begin_Pass(dst);
+	vector<float> sum(width);
+
+	for (int c = 0; c < 3; c++)
+	{
+		for (int y = 0; y < height; y++)
+		{
+			fill(sum.begin(), sum.end(), 0.f);
+
+			for (int i = -distance; i < size - distance; i++)
+			{
+				if (y + i < 0 || y + i >= height)
+					continue;
+
+				const T* src = Row(c, y + i);
+				const int* maskRow = mask + (distance + i) * size + distance;
+				for (int j = -distance; j < size - distance; j++)
+				{
+					const float weight = (float)maskRow[j];
+					const int first = j < 0 ? -j : 0;
+					const int last = j > 0 ? width - j : width;
+
+					for (int x = first; x < last; x++)
+						sum[x] += src[x + j] * weight;
+				}
+			}
+
+			T* row = dst[c] + y * stride;
+			for (int x = 0; x < width; x++)
+				row[x] = Channel<T>::Put(sum[x] / divisor, bClamp);
+		}
+	}
+
+	End_Pass(next);
+}// Convolve
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve the color planes with kernel across and then down.  The 
+//  pass along the rows goes into a float scratch plane, so nothing is 
+//  rounded between the two, and the pass down the columns reads from it 
+//  into a new block, as Convolve's pass does.  Each pass adds in one tap of the kernel at a time over 
+//  a whole row, a loop with no edge tests in it for the compiler to 
+//  vectorize; the taps that would reach past an edge are cut from the row.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class T>
+void PlanarImageOf<T>::Convolve_Separable(const float* kernel, int size)
+{
+	const int distance = size / 2;
+	if (!width || !height)
+		return;
+
+	T* out[4];
+	unsigned char* next = Begin_Pass(out);
+
+	// the scratch plane, with a row after it to sum a column pass in
+	float* scratch = (float*)TargaImage::Alloc_Pixels((height + 1) * stride * sizeof(float));
+	float* sum = scratch + height * stride;
+
+	for (int c = 0; c < 3; c++)
+	{
+		for (int y = 0; y < height; y++)
+		{
+			const T* src = Row(c, y);
+			float* dst = scratch + y * stride;
+			memset(dst, 0, width * sizeof(float));
+
+			for (int j = -distance; j < size - distance; j++)
+			{
+				const float weight = kernel[distance + j];
+				const int first = j < 0 ? -j : 0;
+				const int last = j > 0 ? width - j : width;
+
+				for (int x = first; x < last; x++)
+					dst[x] += src[x + j] * weight;
+			}
+		}
+
+		for (int y = 0; y < height; y++)
+		{
+			memset(sum, 0, width * sizeof(float));
+
+			for (int i = -distance; i < size - distance; i++)
+			{
+				if (y + i < 0 || y + i >= height)
+					continue;
+
+				const float weight = kernel[distance + i];
+				const float* src = scratch + (y + i) * stride;
+
+				for (int x = 0; x < width; x++)
+					sum[x] += src[x] * weight;
+			}
+
+			T* dst = out[c] + y * stride;
+			for (int x = 0; x < width; x++)
+				dst[x] = Channel<T>::Put(sum[x], false);
+		}
+	}
+
+	TargaImage::Free_Pixels((unsigned char*)scratch);
+	End_Pass(next);
+}// Convolve_Separable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Box filter the color planes.  Moving the box a pixel on adds the 
+//  column or row it takes in and takes away the one it leaves, so each 
+//  pass costs two additions a pixel whatever the size.  The pass along the
+//  rows keeps its sum as it walks; the pass down the columns keeps a row of 
+//  sums and updates the whole row at once.  Sums are kept in double so the
+//  adding and taking away doesn't drift over a long row or column.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class T>
+void PlanarImageOf<T>::Box_Blur(int size)
+{
+	const int behind = size / 2;            // pixels the box reaches before the one it's on
+	const int ahead = size - behind - 1;    // and after
+	const double area = (double)size * size;
+	if (!width || !height)
+		return;
+
+	T* out[4];
+	unsigned char* next = Begin_Pass(out);
+	float* scratch = (float*)TargaImage::Alloc_Pixels(height * stride * sizeof(float));
+	vector<double> sum(width);
+
+	for (int c = 0; c < 3; c++)
+	{
+		for (int y = 0; y < height; y++)
+		{
+			const T* src = Row(c, y);
+			float* dst = scratch + y * stride;
+
+			double run = 0;
+			for (int x = 0; x < ahead && x < width; x++)
+				run += src[x];
+
+			for (int x = 0; x < width; x++)
+			{
+				if (x + ahead < width)
+					run += src[x + ahead];
+				if (x - behind > 0)
+					run -= src[x - behind - 1];
+				dst[x] = (float)run;
+			}
+		}
+
+		fill(sum.begin(), sum.end(), 0.0);
+		for (int y = 0; y < ahead && y < height; y++)
+		{
+			const float* src = scratch + y * stride;
+			for (int x = 0; x < width; x++)
+				sum[x] += src[x];
+		}
+
+		for (int y = 0; y < height; y++)
+		{
+			if (y + ahead < height)
+			{
+				const float* src = scratch + (y + ahead) * stride;
+				for (int x = 0; x < width; x++)
+					sum[x] += src[x];
+			}
+			if (y - behind > 0)
+			{
+				const float* src = scratch + (y - behind - 1) * stride;
+				for (int x = 0; x < width; x++)
+					sum[x] -= src[x];
+			}
+
+			T* dst = out[c] + y * stride;
+			for (int x = 0; x < width; x++)
+				dst[x] = Channel<T>::Put((float)(sum[x] / area), false);
+		}
+	}
+
+	TargaImage::Free_Pixels((unsigned char*)scratch);
+	End_Pass(next);
+}// Box_Blur
+
+
+template class PlanarImageOf<float>;
+template class PlanarImageOf<unsigned short>;
@@ -0,0 +1,95 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PlanarImage.h
+//
+//      An image as four planes -- red, green, blue and alpha, each
+//  pre-multiplied.  Filters work on it so that a chain of them keeps more
+//  than 8 bits per channel instead of rounding after every step, and so
+//  each channel is a plain run of values a loop can vectorize over.
+//
+//      The planes hold floats running 0 to 255 like TargaImage's bytes, or
+//  16-bit integers running 0 to 65535 at half the memory.  Both are the one
+//  template, PlanarImageOf, so every filter is written once for either.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _PLANAR_IMAGE_H_
+#define _PLANAR_IMAGE_H_
+
+#include <stddef.h>
+
+class TargaImage;
+
+class PlanarImage
+{
+    // methods
+    public:
+        virtual ~PlanarImage(void) {}
+
+        // unpack image's pixels into planes of depth bits per channel:  16, or 32 for float
+        static PlanarImage* Create(const TargaImage& image, int depth);
+
+        // pack the planes into image's data, rounding to 8 bits.  image's top left pixel is
+        // column x, row y of the planes, and the planes must cover it from there
+        virtual void Store(TargaImage& image, int x, int y) const = 0;
+
+        // convolve the red, green and blue planes with a size x size mask, dividing each sum
+        // by divisor.  Pixels past the edges count as 0.  bClamp keeps the results in range,
+        // for masks with negative weights.  Each pass of a filter reads the planes and writes
+        // a second block that then takes their place, so the result doesn't depend on the
+        // order pixels are done in
+        virtual void Convolve(const int* mask, int size, int divisor, bool bClamp) = 0;
+
+        // convolve the red, green and blue planes with the size x size mask that is kernel's
+        // outer product with itself, as a pass along the rows and then one down the columns.
+        // Each pixel costs 2 * size multiplies instead of size * size.  Pixels past the edges
+        // count as 0
+        virtual void Convolve_Separable(const float* kernel, int size) = 0;
+
+        // average the red, green and blue planes over a size x size box, with running sums
+        // along the rows and down the columns, so the cost per pixel doesn't grow with size.
+        // Pixels past the edges count as 0
+        virtual void Box_Blur(int size) = 0;
+
+    // members
+    public:
+        int             width;          // width of the image in pixels
+        int             height;         // height of the image in pixels
+        int             depth;          // bits per channel, 32 meaning float
+        size_t          stride;         // channels from one row of a plane to the next; rows are 64-byte aligned
+};
+
+
+template <class T>
+class PlanarImageOf : public PlanarImage
+{
+    // methods
+    public:
+        explicit PlanarImageOf(const TargaImage& image);
+        ~PlanarImageOf(void);
+
+        void Store(TargaImage& image, int x, int y) const;
+        void Convolve(const int* mask, int size, int divisor, bool bClamp);
+        void Convolve_Separable(const float* kernel, int size);
+        void Box_Blur(int size);
+
+        T* Row(int channel, int y) { return planes[channel] + (size_t)y * stride; }
+
+    private:
+        // planes are several times the size of the image's pixels; images share those, never these
+        PlanarImageOf(const PlanarImageOf&);            // not copyable
+        PlanarImageOf& operator=(const PlanarImageOf&); // not assignable
+
+        void Alloc_Planes(int w, int h);
+        unsigned char* Begin_Pass(T* dst[4]);       // a pooled block for a pass to write, alpha copied in
+        void End_Pass(unsigned char* next);         // swap next in for the planes, pooling the old block
+
+    // members
+    public:
+        T*              planes[4];      // red, green, blue and alpha
+
+    private:
+        unsigned char*  block;          // the four planes, one after another, from the pixel pool
+};
+
+#endif
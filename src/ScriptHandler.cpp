@@ -13,6 +13,12 @@
 #include "ScriptHandler.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <future>
+#include <algorithm>
 #include <string.h>
 #include "TargaImage.h"
 
@@ -20,10 +26,15 @@ using namespace std;
 
 // constants
 const int       c_maxLineLength         = 1000;                         // maximum length of a command in a script
+const size_t    c_prefetchDepth         = 2;                            // images a script may have loading ahead of it
 const char      c_sWhiteSpace[]         = " \t\n\r"; 
 const char      c_asCommands[][32]      = { "load",                     // valid commands
                                             "save",
+                                            "save-rle",
+                                            "save-rgba",
                                             "run",
+                                            "info",
+                                            "bands",
                                             "gray",
                                             "quant-unif",
                                             "quant-pop",
@@ -35,6 +46,7 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "dither-pattern",
                                             "dither-color",
                                             "filter-box",
+                                            "filter-box-n",
                                             "filter-bartlett",
                                             "filter-gauss",
                                             "filter-gauss-n",
@@ -50,14 +62,19 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "comp-atop",
                                             "comp-xor",
                                             "diff",
-                                            "rotate"
+                                            "rotate",
+                                            "depth"
                                           };
 
 enum ECommands          // command ids
 {
     LOAD,
     SAVE,
+    SAVE_RLE,
+    SAVE_RGBA,
     RUN,
+    INFO,
+    BANDS,
     GRAY,
     QUANT_UNIF,
     QUANT_POP,
@@ -69,6 +86,7 @@ enum ECommands          // command ids
     DITHER_PATTERN,
     DITHER_COLOR,
     FILTER_BOX,
+    FILTER_BOX_N,
     FILTER_BARTLETT,
     FILTER_GAUSS,
     FILTER_GAUSS_N,
@@ -85,10 +103,261 @@ enum ECommands          // command ids
     COMP_XOR,
     DIFF,
     ROTATE,
+    DEPTH,
     NUM_COMMANDS
 };// ECommands
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Loads the images a script is about to use on background threads, so
+//  the loading overlaps the commands before them.  Only scripts prefetch;
+//  commands typed one at a time load as they come.
+//
+///////////////////////////////////////////////////////////////////////////////
+class CImagePrefetcher
+{
+    public:
+        ~CImagePrefetcher();
+
+        // start loading the images named by the script from line nFirst on
+        void Scan(const vector<string>& asLines, size_t nFirst);
+
+        // hand over the image for the file if it was prefetched, NULL if it failed to load
+        bool Take(const char* sFilename, TargaImage*& pImage);
+
+    private:
+        static TargaImage* Load(string sFilename);
+
+        map<string, future<TargaImage*> > m_pending;   // loads under way, by filename
+};// CImagePrefetcher
+
+static CImagePrefetcher* s_pPrefetcher = NULL;         // the running script's prefetcher
+
+// makes a script's prefetcher the running one while the script runs, and puts back the one
+// for the script that ran it however the script ends -- even by an exception
+class CPrefetcherScope
+{
+    public:
+        explicit CPrefetcherScope(CImagePrefetcher* pPrefetcher) : m_pOuter(s_pPrefetcher) { s_pPrefetcher = pPrefetcher; }
+        ~CPrefetcherScope() { s_pPrefetcher = m_pOuter; }
+
+    private:
+        CImagePrefetcher*   m_pOuter;
+};// CPrefetcherScope
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Find the id of a command, NUM_COMMANDS if it's not one.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int FindCommand(const char* sToken)
+{
+    int command;
+    for (command = 0; command < NUM_COMMANDS; ++command)
+        if (!strcmp(sToken, c_asCommands[command]))
+            break;
+
+    return command;
+}// FindCommand
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load an image for a command, taking it from the running script's 
+//  prefetcher if it has it.  If a region is given only that part of the 
+//  image is kept.
+//
+///////////////////////////////////////////////////////////////////////////////
+static TargaImage* LoadCommandImage(char* sFilename, const int* aRegion = NULL)
+{
+    TargaImage* pImage;
+    if (!sFilename || !s_pPrefetcher || !s_pPrefetcher->Take(sFilename, pImage))
+        pImage = TargaImage::Load_Image(sFilename);
+
+    if (pImage && aRegion)
+    {
+        TargaImage  region(pImage->View(aRegion[0], aRegion[1], aRegion[2], aRegion[3]));
+        TargaImage* pWhole = pImage;
+
+        pImage = new TargaImage(region);
+        delete pWhole;
+    }// if
+
+    return pImage;
+}// LoadCommandImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      If the last word of the command line is a region, "@x,y,w,h", read it
+//  into aRegion and cut it off the line.  Return whether there was one.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool ParseRegion(char* sCommandLine, int aRegion[4])
+{
+    char* sEnd = sCommandLine + strlen(sCommandLine);
+    while (sEnd > sCommandLine && strchr(c_sWhiteSpace, sEnd[-1]))
+        --sEnd;
+
+    char* sStart = sEnd;
+    while (sStart > sCommandLine && !strchr(c_sWhiteSpace, sStart[-1]))
+        --sStart;
+
+    // the command itself comes first
+    if (sStart == sCommandLine || *sStart != '@')
+        return false;
+
+    char cExtra;
+    *sEnd = '\0';
+    if (sscanf(sStart, "@%d,%d,%d,%d%c", &aRegion[0], &aRegion[1], &aRegion[2], &aRegion[3], &cExtra) != 4)
+        return false;
+
+    *sStart = '\0';
+    return true;
+}// ParseRegion
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Whether a command can work on a region of the image.  Those are the 
+//  ones that change pixels in place.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool TakesRegion(int command)
+{
+    switch (command)
+    {
+        case GRAY:
+        case QUANT_UNIF:
+        case QUANT_POP:
+        case DITHER_THRESH:
+        case DITHER_RAND:
+        case DITHER_FS:
+        case DITHER_BRIGHT:
+        case DITHER_CLUSTER:
+        case DITHER_PATTERN:
+        case DITHER_COLOR:
+        case FILTER_BOX:
+        case FILTER_BOX_N:
+        case FILTER_BARTLETT:
+        case FILTER_GAUSS:
+        case FILTER_GAUSS_N:
+        case FILTER_EDGE:
+        case FILTER_ENHANCE:
+        case NPR_PAINT:
+        case COMP_OVER:
+        case COMP_IN:
+        case COMP_OUT:
+        case COMP_ATOP:
+        case COMP_XOR:
+        case DIFF:
+            return true;
+
+        default:
+            return false;
+    }// switch
+}// TakesRegion
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Wait for and throw away any loads still under way.
+//
+///////////////////////////////////////////////////////////////////////////////
+CImagePrefetcher::~CImagePrefetcher()
+{
+    for (map<string, future<TargaImage*> >::iterator it = m_pending.begin(); it != m_pending.end(); ++it)
+        delete it->second.get();
+}// ~CImagePrefetcher
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Start loading the images named by load, comp-* and diff commands from
+//  line nFirst on, until c_prefetchDepth loads are under way.  A file saved
+//  before it is loaded again is left alone, as its contents will change, and
+//  the scan stops at run, since the script run could save anything.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImagePrefetcher::Scan(const vector<string>& asLines, size_t nFirst)
+{
+    vector<string> asSaved;
+
+    for (size_t i = nFirst; i < asLines.size() && m_pending.size() < c_prefetchDepth; ++i)
+    {
+        istringstream line(asLines[i]);
+        string sCommand, sFilename;
+        line >> sCommand >> sFilename;
+
+        switch (FindCommand(sCommand.c_str()))
+        {
+            case RUN:
+                return;
+
+            case SAVE:
+            case SAVE_RLE:
+            case SAVE_RGBA:
+                asSaved.push_back(sFilename);
+                break;
+
+            case BANDS:
+            {
+                // what was read as the filename is the operation; the file written comes after the one read
+                string sIn, sOut;
+                line >> sIn >> sOut;
+                asSaved.push_back(sOut);
+                break;
+            }// BANDS
+
+            case LOAD:
+            case COMP_OVER:
+            case COMP_IN:
+            case COMP_OUT:
+            case COMP_ATOP:
+            case COMP_XOR:
+            case DIFF:
+                if (!sFilename.empty() && !m_pending.count(sFilename) &&
+                    find(asSaved.begin(), asSaved.end(), sFilename) == asSaved.end())
+                    m_pending[sFilename] = async(launch::async, Load, sFilename);
+                break;
+        }// switch
+    }// for
+}// Scan
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      If the file was prefetched, wait for it to finish loading and hand it 
+//  over.  The image is NULL if it failed to load.  Return false if it was
+//  never prefetched.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CImagePrefetcher::Take(const char* sFilename, TargaImage*& pImage)
+{
+    map<string, future<TargaImage*> >::iterator it = m_pending.find(sFilename);
+    if (it == m_pending.end())
+        return false;
+
+    pImage = it->second.get();
+    m_pending.erase(it);
+    return true;
+}// Take
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Runs on the loading thread.  Load_Image goes through libtarga's 
+//  reentrant calls, so several can run at once.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* CImagePrefetcher::Load(string sFilename)
+{
+    return TargaImage::Load_Image(&sFilename[0]);
+}// Load
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Execute the given command string on the given image.  If the command
@@ -103,21 +372,47 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
     char* sCommandLine = new char[strlen(sCommand) + 1];
     strcpy(sCommandLine, sCommand);
+
+    // a command may end with a region, "@x,y,w,h", to work on just that rectangle
+    int aRegion[4];
+    bool bRegion = ParseRegion(sCommandLine, aRegion);
+
     char* sToken = strtok(sCommandLine, c_sWhiteSpace);
 
     // find command that was given
-    int command;
-    for (command = 0; command < NUM_COMMANDS; ++command)
-        if (!strcmp(sToken, c_asCommands[command]))
-            break;
+    int command = FindCommand(sToken);
 
     // if there's no image only a subset of commands are valid
-    if (!pImage && command != LOAD && command != RUN && command != NUM_COMMANDS)
+    if (!pImage && command != LOAD && command != RUN && command != INFO && command != BANDS && command != NUM_COMMANDS)
     {
         cout << "No image to operate on.  Use \"load\" command to load image." << endl;
         return false;
     }// if
 
+    // a region is worked on through an image that borrows its pixels
+    TargaImage* pRegion = NULL;
+    if (bRegion && command != NUM_COMMANDS)
+    {
+        if (!TakesRegion(command))
+        {
+            cout << "\"" << sToken << "\" doesn't take a region." << endl;
+            delete[] sCommandLine;
+            return false;
+        }// if
+
+        ImageView view = pImage->View(aRegion[0], aRegion[1], aRegion[2], aRegion[3]);
+        if (!view.data)
+        {
+            cout << "Region is outside the image." << endl;
+            delete[] sCommandLine;
+            return false;
+        }// if
+
+        pRegion = new TargaImage(view);
+        pRegion->Set_Depth(pImage->Depth());
+    }// if
+    TargaImage* pTarget = pRegion ? pRegion : pImage;
+
     // handle the command
     bool bResult,
          bParsed = true;
@@ -126,10 +421,17 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
     {
         case LOAD:
         {
+            // the image loaded keeps the depth set for the one it replaces
+            int depth = 32;
             if (pImage)
+            {
+                depth = pImage->Depth();
                 delete pImage;
+            }// if
             char* sFilename = strtok(NULL, c_sWhiteSpace);
-            bResult = (pImage = TargaImage::Load_Image(sFilename)) != NULL;
+            bResult = (pImage = LoadCommandImage(sFilename)) != NULL;
+            if (bResult)
+                pImage->Set_Depth(depth);
 
             if (!bResult)
             {
@@ -144,91 +446,165 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         }// LOAD
 
         case SAVE:
+        case SAVE_RLE:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
             if (!sFilename)
                 cout << "No filename given." << endl;
 
             bParsed = sFilename != NULL;
-            bResult =  bParsed && pImage->Save_Image(sFilename);
+            bResult =  bParsed && pImage->Save_Image(sFilename, command == SAVE_RLE);
             break;
         }// SAVE
 
+        case SAVE_RGBA:
+        {
+            char* sFilename = strtok(NULL, c_sWhiteSpace);
+            if (!sFilename)
+                cout << "No filename given." << endl;
+
+            bParsed = sFilename != NULL;
+            bResult =  bParsed && pImage->Save_RGBA(sFilename);
+            break;
+        }// SAVE_RGBA
+
         case RUN:
         {
             bResult = HandleScriptFile(strtok(NULL, c_sWhiteSpace), pImage);
             break;
         }// RUN
 
+        case INFO:
+        {
+            char* sFilename = strtok(NULL, c_sWhiteSpace);
+            ImageInfo info;
+            bResult = TargaImage::Probe(sFilename, info);
+
+            if (bResult)
+            {
+                cout << sFilename << ": " << info.width << " x " << info.height << ", " << info.depth << " bits";
+                if (info.alphaBits)
+                    cout << ", " << info.alphaBits << " alpha bits";
+                if (info.bPaletted)
+                    cout << ", paletted";
+                if (info.bRLE)
+                    cout << ", run-length encoded";
+                cout << endl;
+            }// if
+            break;
+        }// INFO
+
+        case BANDS:
+        {
+            // bands <operation> <in> <out> [rows]:  run a point operation from one file to
+            // another a band of rows at a time, for images too big to load
+            char* sOperation = strtok(NULL, c_sWhiteSpace);
+            char* sIn = strtok(NULL, c_sWhiteSpace);
+            char* sOut = strtok(NULL, c_sWhiteSpace);
+            char* sRows = strtok(NULL, c_sWhiteSpace);
+            int nRows = sRows ? atoi(sRows) : 256;
+
+            bool (TargaImage::*pOperation)() = NULL;
+            switch (sOperation ? FindCommand(sOperation) : NUM_COMMANDS)
+            {
+                case GRAY:          pOperation = &TargaImage::To_Grayscale;     break;
+                case QUANT_UNIF:    pOperation = &TargaImage::Quant_Uniform;    break;
+                case DITHER_THRESH: pOperation = &TargaImage::Dither_Threshold; break;
+            }// switch
+
+            if (!pOperation || !sIn || !sOut || nRows <= 0)
+            {
+                cout << "Usage:  bands gray|quant-unif|dither-thresh <in> <out> [rows]" << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+                bResult = TargaImage::Process_Bands(sIn, sOut, pOperation, nRows);
+            break;
+        }// BANDS
+
         case GRAY:
         {
-            bResult = pImage->To_Grayscale();
+            bResult = pTarget->To_Grayscale();
             break;
         }// GREY
 
         case QUANT_UNIF:
         {
-            bResult = pImage->Quant_Uniform();
+            bResult = pTarget->Quant_Uniform();
             break;
         }// QUANT_UNIF
 
         case QUANT_POP:
         {
-            bResult = pImage->Quant_Populosity();
+            bResult = pTarget->Quant_Populosity();
             break;
         }// QUANT_POP
 
         case DITHER_THRESH:
         {
-            bResult = pImage->Dither_Threshold();
+            bResult = pTarget->Dither_Threshold();
             break;
         }// QUANT_THRESH
 
         case DITHER_RAND:
         {
-            bResult = pImage->Dither_Random();
+            bResult = pTarget->Dither_Random();
             break;
         }// DITHER_RAND
 
         case DITHER_FS:
         {
-            bResult = pImage->Dither_FS();
+            bResult = pTarget->Dither_FS();
             break;
         }// DITHER_FS
 
         case DITHER_BRIGHT:
         {
-            bResult = pImage->Dither_Bright();
+            bResult = pTarget->Dither_Bright();
             break;
         }// DITHER_BRIGHT
         
         case DITHER_CLUSTER:
         {
-            bResult = pImage->Dither_Cluster();
+            bResult = pTarget->Dither_Cluster();
             break;
         }// DITHER_CLUSTER
         
         case DITHER_COLOR:
         {
-            bResult = pImage->Dither_Color();
+            bResult = pTarget->Dither_Color();
             break;
         }// DITHER_COLOR
 
         case FILTER_BOX:
         {
-            bResult = pImage->Filter_Box();
+            bResult = pTarget->Filter_Box();
             break;
         }// DITHER_BOX
 
+        case FILTER_BOX_N:
+        {
+            char *sN = strtok(NULL, c_sWhiteSpace);
+
+            int N = sN ? atoi(sN) : 0;
+            if (N <= 0 || N % 2 != 1) {
+               cout << "N \"" << (sN ? sN : "") << "\" is not allowed; N must be a positive odd number." << endl;
+               bResult = bParsed = false;
+               break;
+            }
+            bResult = pTarget->Filter_Box_N(N);
+            break;
+        }// FILTER_BOX_N
+
         case FILTER_BARTLETT:
         {
-            bResult = pImage->Filter_Bartlett();
+            bResult = pTarget->Filter_Bartlett();
             break;
         }// DITHER_BARTLETT
 
         case FILTER_GAUSS:
         {
-            bResult = pImage->Filter_Gaussian();
+            bResult = pTarget->Filter_Gaussian();
             break;
         }// FILTER_GUASS
 
@@ -241,25 +617,25 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
                cout << "N \"" << N << "\" is not allowed; N must be an odd number." << endl;
                break;
             }
-            bResult = pImage->Filter_Gaussian_N(N);
+            bResult = pTarget->Filter_Gaussian_N(N);
             break;
         }// FILTER_GUASS_N
 
         case FILTER_EDGE:
         {
-            bResult = pImage->Filter_Edge();
+            bResult = pTarget->Filter_Edge();
             break;
         }// FILTER_EDGE
 
         case FILTER_ENHANCE:
         {
-            bResult = pImage->Filter_Enhance();
+            bResult = pTarget->Filter_Enhance();
             break;
         }// FILTER_ENHANCE
 
         case NPR_PAINT:
         {
-            bResult = pImage->NPR_Paint();
+            bResult = pTarget->NPR_Paint();
             break;
         }// NPR_PAINT
 
@@ -294,7 +670,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         case COMP_OVER:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            TargaImage* pNewImage = LoadCommandImage(sFilename, bRegion ? aRegion : NULL);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -303,7 +679,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
                     cout << "No filename given." << endl;
                 bParsed = false;
             }// if
-            bResult = pNewImage && pImage->Comp_Over(pNewImage);
+            bResult = pNewImage && pTarget->Comp_Over(pNewImage);
             delete pNewImage;
             break;
         }// COMP_OVER
@@ -311,7 +687,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         case COMP_IN:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            TargaImage* pNewImage = LoadCommandImage(sFilename, bRegion ? aRegion : NULL);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -321,7 +697,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
                 bParsed = false;
             }// if
-            bResult = pNewImage && pImage->Comp_In(pNewImage);
+            bResult = pNewImage && pTarget->Comp_In(pNewImage);
             delete pNewImage;
             break;
         }// COMP_IN
@@ -329,7 +705,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         case COMP_OUT:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            TargaImage* pNewImage = LoadCommandImage(sFilename, bRegion ? aRegion : NULL);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -339,7 +715,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
                 bParsed = false;
             }// if
-            bResult = pNewImage && pImage->Comp_Out(pNewImage);
+            bResult = pNewImage && pTarget->Comp_Out(pNewImage);
             delete pNewImage;
             break;
         }// COMP_OUT
@@ -347,7 +723,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         case COMP_ATOP:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            TargaImage* pNewImage = LoadCommandImage(sFilename, bRegion ? aRegion : NULL);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -357,7 +733,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
                 bParsed = false;
             }// if
-            bResult = pNewImage && pImage->Comp_Atop(pNewImage);
+            bResult = pNewImage && pTarget->Comp_Atop(pNewImage);
             delete pNewImage;
             break;
         }// COMP_ATOP
@@ -365,7 +741,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         case COMP_XOR:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            TargaImage* pNewImage = LoadCommandImage(sFilename, bRegion ? aRegion : NULL);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -375,7 +751,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
                 bParsed = false;
             }// if
-            bResult = pNewImage && pImage->Comp_Xor(pNewImage);
+            bResult = pNewImage && pTarget->Comp_Xor(pNewImage);
             delete pNewImage;
             break;
         }// COMP_XOR
@@ -383,7 +759,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         case DIFF:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            TargaImage* pNewImage = LoadCommandImage(sFilename, bRegion ? aRegion : NULL);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -393,7 +769,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
                 bParsed = false;
             }// if
-            bResult = pNewImage && pImage->Difference(pNewImage);
+            bResult = pNewImage && pTarget->Difference(pNewImage);
             delete pNewImage;
             break;
         }// DIFF
@@ -415,6 +791,20 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// ROTATE
 
+        case DEPTH:
+        {
+            char *sBits = strtok(NULL, c_sWhiteSpace);
+
+            if (!sBits || !pImage->Set_Depth(atoi(sBits)))
+            {
+                cout << "Invalid depth; filters work in 16 or 32 bits per channel." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+                bResult = true;
+            break;
+        }// DEPTH
+
         default:
         {
             cout << "Unable to parse command:  " << sCommand << endl;
@@ -423,6 +813,8 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         }// default
     }// switch
 
+    delete pRegion;
+
     delete[] sCommandLine;
 
     return bParsed;
@@ -453,17 +845,35 @@ bool CScriptHandler::HandleScriptFile(const char* sFilename, TargaImage*& pImage
         return false;
     }// if
 
-    bool bResult = true;
+    // read the whole script first so the images it uses can be loaded ahead
+    vector<string> asLines;
     char sLine[c_maxLineLength + 1];
-    while (!inFile.eof() && bResult)
-    {
-        inFile.getline(sLine, c_maxLineLength);
+    while (inFile.getline(sLine, c_maxLineLength))
+        asLines.push_back(sLine);
 
-        if (!inFile.eof())
-            bResult = HandleCommand(sLine, pImage);
-    }// while
+    // getline stops before the end on a line too long for sLine, or on a read error
+    if (!inFile.eof())
+    {
+        if (inFile.bad())
+            cout << "Unable to read file:  " << sFilename << endl;
+        else
+            cout << "Line " << asLines.size() + 1 << " of " << sFilename << " is longer than " 
+                 << c_maxLineLength - 1 << " characters." << endl;
+        return false;
+    }// if
 
     inFile.close();
+
+    CImagePrefetcher prefetcher;
+    CPrefetcherScope scope(&prefetcher);
+
+    bool bResult = true;
+    for (size_t i = 0; i < asLines.size() && bResult; ++i)
+    {
+        prefetcher.Scan(asLines, i);
+        bResult = HandleCommand(asLines[i].c_str(), pImage);
+    }// for
+
     return bResult;
 }// CScriptHandler
 
@@ -11,17 +11,49 @@
 
 #include "Globals.h"
 #include "TargaImage.h"
+#include "PlanarImage.h"
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "libtarga.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <memory.h>
 #include <math.h>
+#include <limits.h>
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <utility>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <new>
 
 using namespace std;
 
+// raw RGBA container:  the signature, then width, height and the bytes from one row to
+// the next as 64-bit little-endian values, zero padding, and the rows of premultiplied
+// pixels as in data from byte c_RGBAHeaderSize on.  a stride of 0 means rows are packed.
+// the header is a cache line long so that a mapped file keeps the pixels aligned.
+const char      c_RGBASignature[8]      = { 'R', 'G', 'B', 'A', 'I', 'M', 'G', '1' };
+const int       c_RGBAHeaderSize        = 64;
+
+// rows of data start on a cache line and are padded out to a whole number of them, so
+// every row is aligned for vector loads and no pixel run straddles two rows' lines
+const size_t    c_rowAlignment          = 64;
+
+// freed pixel buffers are kept for reuse, up to this many bytes of them in all
+const size_t    c_pixelPoolBytes        = (size_t)512 * 1024 * 1024;
+
 // constants
 const int           RED = 0;                // red channel
 const int           GREEN = 1;                // green channel
@@ -30,6 +62,381 @@ const unsigned char BACKGROUND[3] = { 0, 0, 0 };      // background color
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Allocate size bytes aligned to c_rowAlignment.  Throws bad_alloc on 
+//  failure, as new does.
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned char* Alloc_Aligned(size_t size)
+{
+	void* block;
+
+#ifdef _WIN32
+	block = _aligned_malloc(max(size, c_rowAlignment), c_rowAlignment);
+#else
+	if (posix_memalign(&block, c_rowAlignment, max(size, c_rowAlignment)) != 0)
+		block = NULL;
+#endif
+	if (!block)
+		throw bad_alloc();
+
+	return (unsigned char*)block;
+}// Alloc_Aligned
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Free memory from Alloc_Aligned.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Free_Aligned(unsigned char* block)
+{
+#ifdef _WIN32
+	_aligned_free(block);
+#else
+	free(block);
+#endif
+}// Free_Aligned
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Pixel buffers, kept for reuse once freed.  Images and the temporaries
+//  operations make come and go at the same few sizes, and every big 
+//  allocation is fresh pages from the system, faulted in as they're first 
+//  touched and handed back when freed.  Sizes are rounded up to buckets a 
+//  quarter of a power of two apart, so a block is at most a quarter bigger 
+//  than was asked for and serves any request close to its size.  Each 
+//  block starts with a header c_rowAlignment bytes long that holds its 
+//  bucket size and a count of the references to it, so images can share 
+//  pixels; a block goes back to the pool when its last reference is given
+//  back.  Safe to use from several threads.
+//
+///////////////////////////////////////////////////////////////////////////////
+class CPixelPool
+{
+	public:
+		unsigned char* Take(size_t size);
+		void Give(unsigned char* pixels);
+		static atomic<int>& Refs(unsigned char* pixels);
+
+	private:
+		static size_t Bucket_Size(size_t size);
+
+		mutex					m_lock;
+		map<size_t, vector<unsigned char*> >	m_spare;	    // blocks on hand by bucket size, never an empty bucket
+		size_t					m_spareBytes = 0;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The one pool.  It's never destroyed, so images freed while the 
+//  program shuts down still have it to go back to.
+//
+///////////////////////////////////////////////////////////////////////////////
+static CPixelPool& Pixel_Pool()
+{
+	static CPixelPool* pPool = new CPixelPool;
+	return *pPool;
+}// Pixel_Pool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The bucket a request for size bytes falls in:  size rounded up to a 
+//  multiple of the smallest power of two, at least c_rowAlignment, that is 
+//  an eighth of it or more.
+//
+///////////////////////////////////////////////////////////////////////////////
+size_t CPixelPool::Bucket_Size(size_t size)
+{
+	size_t step = c_rowAlignment;
+	while (step * 8 < size)
+		step *= 2;
+
+	return (size + step - 1) / step * step;
+}// Bucket_Size
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Hand out room for size bytes of pixels, aligned to c_rowAlignment, 
+//  from a spare block if there is one.  Throws bad_alloc on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned char* CPixelPool::Take(size_t size)
+{
+	if (size > (size_t)-1 / 2 - c_rowAlignment)
+		throw bad_alloc();
+
+	size_t bucket = Bucket_Size(size);
+	{
+		lock_guard<mutex> lock(m_lock);
+		// a bucket is dropped once it's empty, so Give can evict from any bucket there is
+		map<size_t, vector<unsigned char*> >::iterator it = m_spare.find(bucket);
+		if (it != m_spare.end())
+		{
+			unsigned char* block = it->second.back();
+			it->second.pop_back();
+			if (it->second.empty())
+				m_spare.erase(it);
+			m_spareBytes -= bucket;
+			Refs(block + c_rowAlignment).store(1);
+			return block + c_rowAlignment;
+		}
+	}
+
+	unsigned char* block = Alloc_Aligned(c_rowAlignment + bucket);
+	*(size_t*)block = bucket;
+	new (block + sizeof(size_t)) atomic<int>(1);
+
+	return block + c_rowAlignment;
+}// Take
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The count of references to pixels from Take, kept in its header.
+//
+///////////////////////////////////////////////////////////////////////////////
+atomic<int>& CPixelPool::Refs(unsigned char* pixels)
+{
+	return *(atomic<int>*)(pixels - c_rowAlignment + sizeof(size_t));
+}// Refs
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Give back a reference to pixels from Take.  Once there are none left
+//  the block is kept for reuse if there's room, making room by freeing 
+//  blocks from the biggest buckets first.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CPixelPool::Give(unsigned char* pixels)
+{
+	if (!pixels || Refs(pixels).fetch_sub(1) > 1)
+		return;
+
+	unsigned char* block = pixels - c_rowAlignment;
+	size_t bucket = *(size_t*)block;
+	if (bucket > c_pixelPoolBytes)
+	{
+		Free_Aligned(block);
+		return;
+	}
+
+	vector<unsigned char*> freed;
+	{
+		lock_guard<mutex> lock(m_lock);
+		while (m_spareBytes + bucket > c_pixelPoolBytes)
+		{
+			map<size_t, vector<unsigned char*> >::iterator it = --m_spare.end();
+			freed.push_back(it->second.back());
+			it->second.pop_back();
+			m_spareBytes -= it->first;
+			if (it->second.empty())
+				m_spare.erase(it);
+		}
+
+		m_spare[bucket].push_back(block);
+		m_spareBytes += bucket;
+	}
+
+	// the system gets its memory back outside the lock
+	for (size_t i = 0; i < freed.size(); i++)
+		Free_Aligned(freed[i]);
+}// Give
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Allocate size bytes aligned to c_rowAlignment, from the pool of spare
+//  pixel buffers.  Throws bad_alloc on failure, as new does.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned char* TargaImage::Alloc_Pixels(size_t size)
+{
+	return Pixel_Pool().Take(size);
+}// Alloc_Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Free memory from Alloc_Pixels, which puts it back in the pool once 
+//  nothing else shares it.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Free_Pixels(unsigned char* pixels)
+{
+	Pixel_Pool().Give(pixels);
+}// Free_Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Add a reference to memory from Alloc_Pixels.  Each takes a 
+//  Free_Pixels to let go of.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Share_Pixels(unsigned char* pixels)
+{
+	CPixelPool::Refs(pixels).fetch_add(1);
+}// Share_Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Whether more than one reference is held to memory from Alloc_Pixels.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Pixels_Shared(unsigned char* pixels)
+{
+	return CPixelPool::Refs(pixels).load() > 1;
+}// Pixels_Shared
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The bytes from one row to the next for an image w pixels wide:  a row
+//  of pixels padded to a multiple of c_rowAlignment.
+//
+///////////////////////////////////////////////////////////////////////////////
+size_t TargaImage::Row_Stride(int w)
+{
+	size_t rowSize = (size_t)w * 4;
+	return (rowSize + c_rowAlignment - 1) / c_rowAlignment * c_rowAlignment;
+}// Row_Stride
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Hands libtarga room to decode a w x h image into, laid out as 
+//  Alloc_Data lays out data, so the result can be adopted as it is.  The 
+//  padding is zeroed.  Returns NULL rather than throwing, since the caller 
+//  is C.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void* Alloc_Decoded(int w, int h, size_t* stride, void*)
+{
+	*stride = TargaImage::Row_Stride(w);
+
+	unsigned char* pixels;
+	try
+	{
+		pixels = TargaImage::Alloc_Pixels(*stride * h);
+	}
+	catch (const bad_alloc&)
+	{
+		return NULL;
+	}
+
+	size_t rowSize = (size_t)w * 4;
+	if (*stride > rowSize)
+		for (int i = 0; i < h; i++)
+			memset(pixels + i * *stride + rowSize, 0, *stride - rowSize);
+
+	return pixels;
+}// Alloc_Decoded
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Map a whole file copy-on-write:  writes to the view go to private pages
+//  and never reach the file.  Return NULL if the file can't be mapped.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void* Map_File(const char* filename, size_t& size)
+{
+	void* base = NULL;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0 && (unsigned long long)fileSize.QuadPart <= (size_t)-1)
+	{
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if (mapping)
+		{
+			base = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+		size = (size_t)fileSize.QuadPart;
+	}
+	CloseHandle(file);
+#else
+	int file = open(filename, O_RDONLY);
+	if (file < 0)
+		return NULL;
+
+	struct stat info;
+	if (fstat(file, &info) == 0 && info.st_size > 0 && (unsigned long long)info.st_size <= (size_t)-1)
+	{
+		base = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+		if (base == MAP_FAILED)
+			base = NULL;
+		size = (size_t)info.st_size;
+	}
+	close(file);
+#endif
+
+	return base;
+}// Map_File
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Release a view from Map_File.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Unmap_File(void* base, size_t size)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(base);
+#else
+	munmap(base, size);
+#endif
+}// Unmap_File
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Put a finished file in place of filename.  The old file is replaced 
+//  rather than overwritten, so images still mapped from it keep their pixels.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Replace_File(const char* tempName, const char* filename)
+{
+#ifdef _WIN32
+	return MoveFileExA(tempName, filename, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(tempName, filename) == 0;
+#endif
+}// Replace_File
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Move count bytes on in file.  fseek takes a long, which is only 32 
+//  bits on Windows, and the files we skip through can be far past 2GB.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Skip_File(FILE* file, unsigned long long count)
+{
+#ifdef _WIN32
+	__int64 offset = (__int64)count;
+	return offset >= 0 && (unsigned long long)offset == count && _fseeki64(file, offset, SEEK_CUR) == 0;
+#else
+	off_t offset = (off_t)count;
+	return offset >= 0 && (unsigned long long)offset == count && fseeko(file, offset, SEEK_CUR) == 0;
+#endif
+}// Skip_File
+
+
 // Computes n choose s, efficiently
 double Binomial(int n, int s)
 {
@@ -48,7 +455,7 @@ double Binomial(int n, int s)
 //      Constructor.  Initialize member variables.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage() : width(0), height(0), data(NULL)
+TargaImage::TargaImage() : width(0), height(0), data(NULL), stride(0)
 {}// TargaImage
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -58,7 +465,7 @@ TargaImage::TargaImage() : width(0), height(0), data(NULL)
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage::TargaImage(int w, int h) : width(w), height(h)
 {
-	data = new unsigned char[width * height * 4];
+	Alloc_Data(width, height);
 	ClearToBlack();
 }// TargaImage
 
@@ -71,33 +478,147 @@ TargaImage::TargaImage(int w, int h) : width(w), height(h)
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage::TargaImage(int w, int h, unsigned char* d)
 {
-	int i;
-
 	width = w;
 	height = h;
-	data = new unsigned char[width * height * 4];
+	Alloc_Data(width, height);
+
+	// d has packed rows
+	for (int i = 0; i < height; i++)
+		memcpy(data + i * stride, d + (size_t)i * width * 4, (size_t)width * 4);
+}// TargaImage
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Take over d, which holds h rows stride bytes apart and
+//  must come from Alloc_Pixels; the image frees it.  Nothing is copied.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::TargaImage(int w, int h, unsigned char* d, size_t s)
+	: width(w), height(h), data(d), stride(s)
+{}// TargaImage
 
-	for (i = 0; i < width * height * 4; i++)
-		data[i] = d[i];
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Wrap the pixels of view, so that operations on this image
+//  work on that region of the image it came from.  The pixels stay owned by
+//  that image, which must outlive this one.  Filters read past the region's
+//  edges as far as view's margin allows, so a filtered region matches the 
+//  same part of the whole image filtered.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::TargaImage(const ImageView& view)
+{
+	width = view.width;
+	height = view.height;
+	data = view.data;
+	stride = view.stride;
+	borrowed = true;
+	for (int i = 0; i < 4; i++)
+		margin[i] = view.margin[i];
 }// TargaImage
 
+
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Copy Constructor.  Initialize member to that of input
+//      Copy Constructor.  Initialize member to that of input.  Allocated 
+//  pixels are shared rather than copied, until one of the images changes 
+//  them; mapped or borrowed pixels are copied.  The filters' working copy
+//  is never copied:  image's pixels are brought up to date and shared 
+//  instead.
 //
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage::TargaImage(const TargaImage& image)
 {
+	// Sync changes how image holds its pixels, not what they are
+	const_cast<TargaImage&>(image).Sync();
+
 	width = image.width;
 	height = image.height;
 	data = NULL;
-	if (image.data != NULL) {
-		data = new unsigned char[width * height * 4];
-		memcpy(data, image.data, sizeof(unsigned char) * width * height * 4);
+	stride = 0;
+	if (image.data != NULL && !image.mapping && !image.borrowed) {
+		data = image.data;
+		stride = image.stride;
+		Share_Pixels(data);
 	}
+	else if (image.data != NULL) {
+		Alloc_Data(width, height);
+		for (int i = 0; i < height; i++)
+			memcpy(data + i * stride, image.data + i * image.stride, (size_t)width * 4);
+	}
+
+	depth = image.depth;
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Move Constructor.  Take image's pixels, leaving it empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::TargaImage(TargaImage&& image)
+	: width(0), height(0), data(NULL), stride(0)
+{
+	*this = std::move(image);
+}// TargaImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy Assignment.  Take a copy of image, as the copy constructor does.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage& TargaImage::operator=(const TargaImage& image)
+{
+	if (this != &image)
+		*this = TargaImage(image);
+
+	return *this;
+}// operator=
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Move Assignment.  Free our pixels and take image's, leaving it empty.
+//  However image got its pixels -- allocated, mapped or borrowed -- they 
+//  come along unchanged.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage& TargaImage::operator=(TargaImage&& image)
+{
+	if (this == &image)
+		return *this;
+
+	Free_Data();
+
+	width = image.width;
+	height = image.height;
+	data = image.data;
+	stride = image.stride;
+	mapping = image.mapping;
+	mappingSize = image.mappingSize;
+	borrowed = image.borrowed;
+	for (int i = 0; i < 4; i++)
+		margin[i] = image.margin[i];
+	planes = image.planes;
+	planesNewer = image.planesNewer;
+	planesX = image.planesX;
+	planesY = image.planesY;
+	depth = image.depth;
+
+	image.width = image.height = 0;
+	image.data = NULL;
+	image.stride = 0;
+	image.mapping = NULL;
+	image.mappingSize = 0;
+	image.borrowed = false;
+	image.planes = NULL;
+	image.planesNewer = false;
+
+	return *this;
+}// operator=
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Destructor.  Free image memory.
@@ -105,101 +626,806 @@ TargaImage::TargaImage(const TargaImage& image)
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage::~TargaImage()
 {
-	if (data)
-		delete[] data;
+	Free_Data();
 }// ~TargaImage
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Converts an image to RGB form, and returns the rgb pixel data - 24 
-//  bits per pixel. The returned space should be deleted when no longer 
-//  required.
+//      Release data, however it was made, and any float copy of it.
 //
 ///////////////////////////////////////////////////////////////////////////////
-unsigned char* TargaImage::To_RGB(void)
+void TargaImage::Free_Data()
 {
-	unsigned char* rgb = new unsigned char[width * height * 3];
-	int		    i, j;
+	delete planes;
+	planes = NULL;
+	planesNewer = false;
+
+	if (mapping)
+		Unmap_File(mapping, mappingSize);
+	else if (data && !borrowed)
+		Free_Pixels(data);
+
+	mapping = NULL;
+	mappingSize = 0;
+	borrowed = false;
+	for (int i = 0; i < 4; i++)
+		margin[i] = 0;
+	data = NULL;
+	stride = 0;
+}// Free_Data
 
-	if (!data)
-		return NULL;
 
-	// Divide out the alpha
-	for (i = 0; i < height; i++)
-	{
-		int in_offset = i * width * 4;
-		int out_offset = i * width * 3;
+///////////////////////////////////////////////////////////////////////////////
+//
+//      A view of the whole image, to write through.  It is good until the 
+//  image is next changed, copied, assigned or destroyed; a copy would share
+//  the pixels the view writes to.
+//
+///////////////////////////////////////////////////////////////////////////////
+ImageView TargaImage::View()
+{
+	Unshare();
 
-		for (j = 0; j < width; j++)
-		{
-			RGBA_To_RGB(data + (in_offset + j * 4), rgb + (out_offset + j * 3));
-		}
-	}
+	ImageView view;
+	view.data = data;
+	view.width = width;
+	view.height = height;
+	view.stride = stride;
 
-	return rgb;
-}// TargaImage
+	return view;
+}// View
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Save the image to a targa file. Returns 1 on success, 0 on failure.
+//      A view of the w x h rectangle with its top left corner at x, y, cut 
+//  down to the part inside the image.  The view is empty if none of it is.
+//  Its margin is the rest of the image around it, for filters to read 
+//  from.  It is good for as long as View()'s is.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Save_Image(const char* filename)
+ImageView TargaImage::View(int x, int y, int w, int h)
 {
-	TargaImage* out_image = Reverse_Rows();
+	Unshare();
 
-	if (!out_image)
-		return false;
+	int right = (int)min((long long)x + w, (long long)width);
+	int bottom = (int)min((long long)y + h, (long long)height);
+	x = max(x, 0);
+	y = max(y, 0);
 
-	if (!tga_write_raw(filename, width, height, out_image->data, TGA_TRUECOLOR_32))
-	{
-		cout << "TGA Save Error: %s\n", tga_error_string(tga_get_last_error());
-		return false;
-	}
+	ImageView view;
+	if (!data || right <= x || bottom <= y)
+		return view;
 
-	delete out_image;
+	view.data = data + (size_t)y * stride + (size_t)x * 4;
+	view.width = right - x;
+	view.height = bottom - y;
+	view.stride = stride;
+	view.margin[0] = x;
+	view.margin[1] = y;
+	view.margin[2] = width - right;
+	view.margin[3] = height - bottom;
 
-	return true;
-}// Save_Image
+	return view;
+}// View
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Give data room for a w x h image, in aligned rows padded to a multiple
+//  of c_rowAlignment bytes, and set stride to match.  The padding is zeroed;
+//  the pixels are left as they come.  Any old data must be freed first.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Alloc_Data(int w, int h)
+{
+	size_t rowSize = (size_t)w * 4;
+	stride = Row_Stride(w);
+	data = Alloc_Pixels(stride * h);
+
+	if (stride > rowSize)
+		for (int i = 0; i < h; i++)
+			memset(data + i * stride + rowSize, 0, stride - rowSize);
+}// Alloc_Data
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      If data is mapped from a file, copy it to memory of our own and let the
+//  file go.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Own_Data()
+{
+	if (!mapping)
+		return;
+
+	unsigned char* mapped = data;
+	size_t mappedStride = stride;
+	void* oldMapping = mapping;
+	size_t oldMappingSize = mappingSize;
+
+	mapping = NULL;
+	mappingSize = 0;
+	Alloc_Data(width, height);
+	for (int i = 0; i < height; i++)
+		memcpy(data + i * stride, mapped + i * mappedStride, (size_t)width * 4);
+
+	Unmap_File(oldMapping, oldMappingSize);
+}// Own_Data
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copies of an image share its pixels until one of them changes, so 
+//  this must come before anything writes to data.  If the pixels are shared
+//  they're copied to a buffer this image has to itself.  Mapped pixels are 
+//  already private to the image, and a view is meant to write through to 
+//  the image it came from.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Unshare()
+{
+	// the working copy is out of date once data changes
+	Sync();
+	delete planes;
+	planes = NULL;
+
+	if (!data || mapping || borrowed || !Pixels_Shared(data))
+		return;
+
+	unsigned char* shared = data;
+	size_t sharedStride = stride;
+
+	Alloc_Data(width, height);
+	for (int i = 0; i < height; i++)
+		memcpy(data + i * stride, shared + i * sharedStride, (size_t)width * 4);
+
+	Free_Pixels(shared);
+}// Unshare
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The filters work on a copy of the image with more bits per channel 
+//  and leave data behind, so that a chain of them isn't rounded to 8 bits 
+//  between steps.  This brings data up to date; it must come before 
+//  anything reads data.  The copy is freed once it's packed, as it is 
+//  several times the size of data; the next filter makes a new one.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Sync()
+{
+	if (!planesNewer)
+		return;
+
+	// data may be shared, so it is made our own first -- with the planes
+	// set aside, since doing that drops them
+	PlanarImage* newer = planes;
+	planes = NULL;
+	planesNewer = false;
+	Unshare();
+
+	newer->Store(*this, planesX, planesY);
+	delete newer;
+}// Sync
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve the image with a size x size mask at the image's depth, 
+//  dividing each sum by divisor, as PlanarImage::Convolve does, passes 
+//  times over.  data is left out of date until Sync, except in a view, 
+//  which writes straight through once all the passes are done.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Filter_Planes(const int* mask, int size, int divisor, bool bClamp, int passes)
+{
+	// every pass reaches another size / 2 pixels further past a view's edges
+	Make_Planes(passes * (size / 2));
+	for (int i = 0; i < passes; i++)
+		planes->Convolve(mask, size, divisor, bClamp);
+	planesNewer = true;
+
+	// the image a view came from can't see our planes
+	if (borrowed)
+		Sync();
+}// Filter_Planes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve the image with the mask that is kernel's outer product with 
+//  itself, a row pass and then a column pass, as 
+//  PlanarImage::Convolve_Separable does.  data is left out of date as in 
+//  Filter_Planes.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Filter_Separable(const float* kernel, int size)
+{
+	Make_Planes(size / 2);
+	planes->Convolve_Separable(kernel, size);
+	planesNewer = true;
+
+	if (borrowed)
+		Sync();
+}// Filter_Separable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Average each pixel over the size x size box around it, as 
+//  PlanarImage::Box_Blur does.  data is left out of date as in 
+//  Filter_Planes.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Filter_Box_Sums(int size)
+{
+	Make_Planes(size / 2);
+	planes->Box_Blur(size);
+	planesNewer = true;
+
+	if (borrowed)
+		Sync();
+}// Filter_Box_Sums
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make sure there are planes of the image's depth for a filter to work 
+//  on, unpacking data into them if there aren't.  A view's planes take in
+//  up to radius pixels of the image around it, so a filter sees the same 
+//  neighbors at the view's edges that it would in the whole image, rather 
+//  than counting them as 0.  Sync stores back only the view.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Make_Planes(int radius)
+{
+	// planes made before the depth changed go back into data first
+	if (planes && planes->depth != depth)
+	{
+		Sync();
+		delete planes;
+		planes = NULL;
+	}
+
+	if (planes)
+		return;
+
+	int left = min(margin[0], radius);
+	int top = min(margin[1], radius);
+
+	ImageView reach;
+	reach.data = data ? data - (size_t)top * stride - (size_t)left * 4 : NULL;
+	reach.width = width + left + min(margin[2], radius);
+	reach.height = height + top + min(margin[3], radius);
+	reach.stride = stride;
+
+	planes = PlanarImage::Create(TargaImage(reach), depth);
+	planesX = left;
+	planesY = top;
+}// Make_Planes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the bits per channel the filters work in:  16 for integer 
+//  channels, or 32 for float.  16 bits takes half the memory and is still 
+//  far finer than the 8 bits data is saved in.  A change takes effect at 
+//  the next filter.  Returns false, changing nothing, for other depths.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Set_Depth(int bits)
+{
+	if (bits != 16 && bits != 32)
+		return false;
+
+	depth = bits;
+	return true;
+}// Set_Depth
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The bits per channel the filters work in.
+//
+///////////////////////////////////////////////////////////////////////////////
+int TargaImage::Depth() const
+{
+	return depth;
+}// Depth
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Converts an image to RGB form, and returns the rgb pixel data - 24 
+//  bits per pixel. The returned space should be freed with Free_Pixels when
+//  no longer required.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned char* TargaImage::To_RGB(void)
+{
+	int		    i, j;
+
+	if (!data)
+		return NULL;
+
+	Sync();
+
+	// the window asks for this every time it redraws
+	unsigned char* rgb = Alloc_Pixels((size_t)width * height * 3);
+
+	// Divide out the alpha
+	for (i = 0; i < height; i++)
+	{
+		size_t in_offset = (size_t)i * stride;
+		size_t out_offset = (size_t)i * width * 3;
+
+		for (j = 0; j < width; j++)
+		{
+			RGBA_To_RGB(data + (in_offset + j * 4), rgb + (out_offset + j * 3));
+		}
+	}
+
+	return rgb;
+}// TargaImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Save the image to a targa file, run-length encoded if bRLE is set.
+//  Returns 1 on success, 0 on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Save_Image(const char* filename, bool bRLE)
+{
+	if (!data)
+		return false;
+
+	Sync();
+
+	// our rows run top to bottom, libtarga flips them as it writes
+	int error;
+	int bSaved = tga_write_stride_r(filename, width, height, data, stride, TGA_TRUECOLOR_32 | TGA_ORIGIN_UPPER, bRLE, &error);
+	if (!bSaved)
+	{
+		cout << "TGA Save Error: " << tga_error_string(error) << endl;
+		return false;
+	}
+
+	return true;
+}// Save_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Encode the image as a whole targa file into buffer, run-length encoded
+//  if bRLE is set.  Returns true on success, false on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Save_Image(std::vector<unsigned char>& buffer, bool bRLE)
+{
+	if (!data)
+		return false;
+
+	Sync();
+
+	int error;
+	size_t size;
+	unsigned char* encoded = (unsigned char*)tga_encode_mem_stride(width, height, data, stride, TGA_TRUECOLOR_32 | TGA_ORIGIN_UPPER, bRLE, &size, &error);
+	if (!encoded)
+	{
+		cout << "TGA Save Error: " << tga_error_string(error) << endl;
+		return false;
+	}
+
+	buffer.assign(encoded, encoded + size);
+	free(encoded);
+
+	return true;
+}// Save_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load a targa image from a file.  Return a new TargaImage object which 
+//  must be deleted by caller.  Return NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* TargaImage::Load_Image(char* filename)
+{
+	unsigned char* temp_data;
+	TargaImage* result;
+	int		        width, height;
+	int		        error;
+
+	if (!filename)
+	{
+		cout << "No filename given." << endl;
+		return NULL;
+	}// if
+
+	// images too big for a targa come in our own container
+	if (Is_RGBA_File(filename))
+		return Load_RGBA(filename);
+
+	// uncompressed truecolor files are mapped and converted straight into the
+	// image buffer, rows already top to bottom
+	void* map = tga_map_r(filename, &width, &height, &error);
+	if (map)
+	{
+		result = new TargaImage();
+		result->width = width;
+		result->height = height;
+		result->Alloc_Data(width, height);
+
+		bool bMapped = tga_map_read_stride_r(map, result->data, result->stride, TGA_TRUECOLOR_32 | TGA_ORIGIN_UPPER, &error) != 0;
+		tga_unmap(map);
+
+		if (bMapped)
+			return result;
+
+		delete result;
+	}// if
+
+	// everything else is decoded with the rows already top to bottom, 
+	// straight into memory laid out for the image to adopt
+	temp_data = (unsigned char*)tga_load_alloc_r(filename, &width, &height, TGA_TRUECOLOR_32 | TGA_ORIGIN_UPPER, 
+	                                             Alloc_Decoded, NULL, &error);
+	if (!temp_data)
+	{
+		cout << "TGA Error: " << tga_error_string(error) << endl;
+		width = height = 0;
+		return NULL;
+	}
+
+	return new TargaImage(width, height, temp_data, Row_Stride(width));
+}// Load_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fill info from the header of a targa or raw RGBA file without decoding 
+//  any pixels.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Probe(const char* filename, ImageInfo& info)
+{
+	if (!filename)
+	{
+		cout << "No filename given." << endl;
+		return false;
+	}// if
+
+	info = ImageInfo();
+
+	// our own container first, then a targa
+	unsigned long long w, h, stride;
+	FILE* file = fopen(filename, "rb");
+	bool bRGBA = file && Read_RGBA_Header(file, w, h, stride);
+	if (file)
+		fclose(file);
+
+	if (bRGBA)
+	{
+		info.width = (int)min(w, (unsigned long long)INT_MAX);
+		info.height = (int)min(h, (unsigned long long)INT_MAX);
+		info.depth = 32;
+		info.alphaBits = 8;
+		return true;
+	}// if
+
+	tga_info header;
+	int error;
+	if (!tga_probe_r(filename, &header, &error))
+	{
+		cout << "TGA Error: " << tga_error_string(error) << endl;
+		return false;
+	}
+
+	info.width = header.width;
+	info.height = header.height;
+	info.depth = header.pix_depth;
+	info.alphaBits = header.alphabits;
+	info.bRLE = header.rle != 0;
+	info.bPaletted = header.paletted != 0;
+
+	return true;
+}// Probe
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Save the image to the raw RGBA container.  Unlike a targa it holds
+//  images of any size, stored as they are in memory, so Load_RGBA can map 
+//  it straight back.  The file is written beside filename and then put in 
+//  its place, so images mapped from the old file are left alone.  Returns 
+//  true on success, false on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Save_RGBA(const char* filename)
+{
+	if (!data || !filename)
+		return false;
+
+	Sync();
+
+	// windows won't replace a file that's mapped
+	Own_Data();
+
+	// rows are padded as Alloc_Data pads them, whatever data's own stride is
+	size_t rowSize = (size_t)width * 4;
+	size_t fileStride = (rowSize + c_rowAlignment - 1) / c_rowAlignment * c_rowAlignment;
+	unsigned char padding[c_rowAlignment] = { 0 };
+
+	unsigned char header[c_RGBAHeaderSize] = { 0 };
+	memcpy(header, c_RGBASignature, sizeof(c_RGBASignature));
+	for (int i = 0; i < 8; i++)
+	{
+		header[8 + i] = (unsigned char)((unsigned long long)width >> (8 * i));
+		header[16 + i] = (unsigned char)((unsigned long long)height >> (8 * i));
+		header[24 + i] = (unsigned char)((unsigned long long)fileStride >> (8 * i));
+	}
+
+	string tempName = string(filename) + ".part";
+	FILE* file = fopen(tempName.c_str(), "wb");
+	if (!file)
+	{
+		cout << "Unable to open " << tempName << " for writing" << endl;
+		return false;
+	}
+
+	bool bSaved = fwrite(header, 1, c_RGBAHeaderSize, file) == (size_t)c_RGBAHeaderSize;
+	for (int i = 0; i < height && bSaved; i++)
+		bSaved = fwrite(data + i * stride, 1, rowSize, file) == rowSize
+		      && fwrite(padding, 1, fileStride - rowSize, file) == fileStride - rowSize;
+	if (fclose(file) != 0)
+		bSaved = false;
+
+	if (bSaved && !Replace_File(tempName.c_str(), filename))
+	{
+		cout << "Unable to replace " << filename << endl;
+		remove(tempName.c_str());
+		return false;
+	}
+
+	if (!bSaved)
+	{
+		cout << "Unable to write " << filename << endl;
+		remove(tempName.c_str());
+	}
+
+	return bSaved;
+}// Save_RGBA
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load an image from the raw RGBA container.  When its rows are aligned
+//  as in data the file is mapped copy-on-write and used in place, so the 
+//  load reads nothing up front and changes to the image never reach the 
+//  file.  Otherwise the rows are read in.  Return a new TargaImage object 
+//  which must be deleted by caller.  Return NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* TargaImage::Load_RGBA(const char* filename)
+{
+	if (!filename)
+		return NULL;
+
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+	{
+		cout << "Unable to open " << filename << endl;
+		return NULL;
+	}
+
+	unsigned long long w, h, stride;
+	if (!Read_RGBA_Header(file, w, h, stride))
+	{
+		cout << filename << " is not a raw RGBA image" << endl;
+		fclose(file);
+		return NULL;
+	}
+
+	// the sizes have to fit our members and the pixels our address space
+	if (stride == 0)
+		stride = w * 4;
+	if (w == 0 || h == 0 || w > INT_MAX || h > INT_MAX || w > (size_t)-1 / 4 / h
+	 || stride < w * 4 || stride > ((size_t)-1 - c_RGBAHeaderSize) / h)
+	{
+		cout << filename << " has bad dimensions" << endl;
+		fclose(file);
+		return NULL;
+	}
+
+	TargaImage* result = new TargaImage();
+	result->width = (int)w;
+	result->height = (int)h;
+
+	// the header is a whole number of cache lines, so aligned rows in the file 
+	// are aligned in the mapping
+	size_t rowSize = (size_t)w * 4;
+	if (stride % c_rowAlignment == 0)
+	{
+		size_t mappingSize;
+		void* mapping = Map_File(filename, mappingSize);
+		if (mapping && mappingSize >= c_RGBAHeaderSize + stride * h)
+		{
+			fclose(file);
+			result->mapping = mapping;
+			result->mappingSize = mappingSize;
+			result->data = (unsigned char*)mapping + c_RGBAHeaderSize;
+			result->stride = (size_t)stride;
+			return result;
+		}
+		if (mapping)
+			Unmap_File(mapping, mappingSize);
+	}
+
+	result->Alloc_Data((int)w, (int)h);
+
+	bool bLoaded = true;
+	for (size_t y = 0; y < h && bLoaded; y++)
+	{
+		bLoaded = fread(result->data + y * result->stride, 1, rowSize, file) == rowSize;
+		if (stride > rowSize && y + 1 < h)
+			bLoaded = bLoaded && Skip_File(file, stride - rowSize);
+	}
+	fclose(file);
+
+	if (!bLoaded)
+	{
+		cout << "Unexpected end of " << filename << endl;
+		delete result;
+		return NULL;
+	}
+
+	return result;
+}// Load_RGBA
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read the raw RGBA container's header from the start of file, leaving
+//  the file at the first pixel.  Return false if it isn't one.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Read_RGBA_Header(FILE* file, unsigned long long& w, unsigned long long& h,
+                                  unsigned long long& stride)
+{
+	unsigned char header[c_RGBAHeaderSize];
+	if (fread(header, 1, c_RGBAHeaderSize, file) != (size_t)c_RGBAHeaderSize
+	 || memcmp(header, c_RGBASignature, sizeof(c_RGBASignature)))
+		return false;
+
+	w = h = stride = 0;
+	for (int i = 7; i >= 0; i--)
+	{
+		w = (w << 8) | header[8 + i];
+		h = (h << 8) | header[16 + i];
+		stride = (stride << 8) | header[24 + i];
+	}
+
+	return true;
+}// Read_RGBA_Header
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Check for the raw RGBA container's signature at the start of a file.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Is_RGBA_File(const char* filename)
+{
+	char signature[sizeof(c_RGBASignature)];
+
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+		return false;
+
+	bool bMatch = fread(signature, 1, sizeof(signature), file) == sizeof(signature)
+	           && !memcmp(signature, c_RGBASignature, sizeof(signature));
+	fclose(file);
+
+	return bMatch;
+}// Is_RGBA_File
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load a targa image from a buffer holding a whole targa file.  Return a
+//  new TargaImage object which must be deleted by caller.  Return NULL on 
+//  failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* TargaImage::Load_Image(const unsigned char* buffer, size_t size)
+{
+	unsigned char* temp_data;
+	int		        width, height;
+	int		        error;
+
+	if (!buffer)
+	{
+		cout << "No buffer given." << endl;
+		return NULL;
+	}// if
+
+	temp_data = (unsigned char*)tga_decode_mem_alloc(buffer, size, &width, &height, TGA_TRUECOLOR_32 | TGA_ORIGIN_UPPER, 
+	                                                 Alloc_Decoded, NULL, &error);
+	if (!temp_data)
+	{
+		cout << "TGA Error: " << tga_error_string(error) << endl;
+		return NULL;
+	}
+
+	return new TargaImage(width, height, temp_data, Row_Stride(width));
+}// Load_Image
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Load a targa image from a file.  Return a new TargaImage object which 
-//  must be deleted by caller.  Return NULL on failure.
+//      Apply a point operation to the image in file sIn and save it to sOut,
+//  run-length encoded if bRLE is set.  Only nBandRows rows are held in memory
+//  at once, so the operation must not look past the pixel it is changing.
+//  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage* TargaImage::Load_Image(char* filename)
+bool TargaImage::Process_Bands(const char* sIn, const char* sOut, bool (TargaImage::*pOperation)(),
+                               int nBandRows, bool bRLE)
 {
-	unsigned char* temp_data;
-	TargaImage* temp_image;
-	TargaImage* result;
-	int		        width, height;
+	int width, height;
+	int error;
 
-	if (!filename)
+	if (!sIn || !sOut || nBandRows <= 0)
+		return false;
+
+	void* reader = tga_band_open_r(sIn, &width, &height, TGA_TRUECOLOR_32 | TGA_ORIGIN_UPPER, &error);
+	if (!reader)
 	{
-		cout << "No filename given." << endl;
-		return NULL;
-	}// if
+		cout << "TGA Error: " << tga_error_string(error) << endl;
+		return false;
+	}
 
-	temp_data = (unsigned char*)tga_load(filename, &width, &height, TGA_TRUECOLOR_32);
-	if (!temp_data)
+	void* writer = tga_band_create_r(sOut, width, height, TGA_TRUECOLOR_32 | TGA_ORIGIN_UPPER, bRLE, &error);
+	if (!writer)
 	{
-		cout << "TGA Error: %s\n", tga_error_string(tga_get_last_error());
-		width = height = 0;
-		return NULL;
+		cout << "TGA Save Error: " << tga_error_string(error) << endl;
+		tga_band_close(reader);
+		return false;
 	}
-	temp_image = new TargaImage(width, height, temp_data);
-	free(temp_data);
 
-	result = temp_image->Reverse_Rows();
+	// the band is an image of its own; its height shrinks for the last, short band.
+	// each band is read and written whole, straight into and out of its padded rows,
+	// so a file stored bottom up costs one seek a band rather than one a row
+	const int nBandHeight = min(nBandRows, height);
+	TargaImage band(width, nBandHeight);
+	int nRows;
+	bool bWritten = true;
+	while (bWritten)
+	{
+		nRows = tga_band_read_stride_r(reader, band.data, band.stride, nBandHeight, &error);
+		if (nRows == 0)
+			break;
+
+		band.height = nRows;
+		(band.*pOperation)();
 
-	delete temp_image;
+		bWritten = tga_band_write_stride_r(writer, band.data, band.stride, nRows, &error) == nRows;
+	}// while
+	tga_band_close(reader);
 
-	return result;
-}// Load_Image
+	// a failed write stops the loop early and is reported by finishing
+	if (nRows == 0 && error)
+		cout << "TGA Error: " << tga_error_string(error) << endl;
+
+	bool bFinished = tga_band_finish_r(writer, &error) != 0;
+	if (!bFinished)
+		cout << "TGA Save Error: " << tga_error_string(error) << endl;
+
+	return bFinished;
+}// Process_Bands
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -211,6 +1437,8 @@ TargaImage* TargaImage::Load_Image(char* filename)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::To_Grayscale()
 {
+	Unshare();
+
 	for (int i = 0; i < height; i++)
 	{
 		for (int j = 0; j < width; j++)
@@ -237,6 +1465,8 @@ bool TargaImage::To_Grayscale()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Quant_Uniform()
 {
+	Unshare();
+
 	for (int i = 0; i < height; i++)
 	{
 		for (int j = 0; j < width; j++)
@@ -265,6 +1495,8 @@ bool TargaImage::Quant_Uniform()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Quant_Populosity()
 {
+	Unshare();
+
 
 	// uniform quantity first
 	for (int y = 0; y < height; y++)
@@ -366,6 +1598,8 @@ bool TargaImage::Quant_Populosity()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Threshold()
 {
+	Unshare();
+
 	for (int i = 0; i < height; i++)
 	{
 		for (int j = 0; j < width; j++)
@@ -402,6 +1636,8 @@ bool TargaImage::Dither_Threshold()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Random()
 {
+	Unshare();
+
 	// random
 	srand(time(NULL));
 	double randNum = (double)rand() / ((double)RAND_MAX) * 0.4 - 0.2;
@@ -446,6 +1682,8 @@ bool TargaImage::Dither_Random()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_FS()
 {
+	Unshare();
+
 	To_Grayscale();
 
 	// zig-zag way then find closest color
@@ -584,6 +1822,8 @@ bool TargaImage::Dither_FS()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Bright()
 {
+	Unshare();
+
 	vector <double> tSort;
 	double tSum = 0, tArv = 0;
 	for (int i = 0; i < height; i++)
@@ -598,8 +1838,8 @@ bool TargaImage::Dither_Bright()
 
 	}
 	sort(tSort.begin(), tSort.end());
-	tArv = tSum / (double)(height * width);
-	int  th = (1 - tArv) * height * width;
+	tArv = tSum / ((double)height * width);
+	size_t th = (size_t)((1 - tArv) * height * width);
 	double threshold = tSort[th];
 	cout << "arv:" << threshold << endl;
 	for (int i = 0; i < height; i++)
@@ -639,6 +1879,8 @@ bool TargaImage::Dither_Bright()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Cluster()
 {
+	Unshare();
+
 	double mask[][4] = { {0.7059, 0.3529, 0.5882, 0.2353},
 		{0.0588, 0.9412, 0.8235, 0.4118},
 		{0.4706, 0.7647, 0.8824, 0.1176 },
@@ -684,6 +1926,8 @@ bool TargaImage::Dither_Cluster()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Color()
 {
+	Unshare();
+
 	// zig-zag way then find closest color
 
 	for (int y = 0; y < height; y++)
@@ -815,6 +2059,8 @@ bool TargaImage::Dither_Color()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_Over(TargaImage* pImage)
 {
+	Unshare();
+
 	if (width != pImage->width || height != pImage->height)
 	{
 		cout << "Comp_Over: Images not the same size\n";
@@ -834,6 +2080,8 @@ bool TargaImage::Comp_Over(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_In(TargaImage* pImage)
 {
+	Unshare();
+
 	if (width != pImage->width || height != pImage->height)
 	{
 		cout << "Comp_In: Images not the same size\n";
@@ -853,6 +2101,8 @@ bool TargaImage::Comp_In(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_Out(TargaImage* pImage)
 {
+	Unshare();
+
 	if (width != pImage->width || height != pImage->height)
 	{
 		cout << "Comp_Out: Images not the same size\n";
@@ -872,6 +2122,8 @@ bool TargaImage::Comp_Out(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_Atop(TargaImage* pImage)
 {
+	Unshare();
+
 	if (width != pImage->width || height != pImage->height)
 	{
 		cout << "Comp_Atop: Images not the same size\n";
@@ -891,6 +2143,8 @@ bool TargaImage::Comp_Atop(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_Xor(TargaImage* pImage)
 {
+	Unshare();
+
 	if (width != pImage->width || height != pImage->height)
 	{
 		cout << "Comp_Xor: Images not the same size\n";
@@ -910,6 +2164,8 @@ bool TargaImage::Comp_Xor(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Difference(TargaImage* pImage)
 {
+	Unshare();
+
 	if (!pImage)
 		return false;
 
@@ -919,18 +2175,26 @@ bool TargaImage::Difference(TargaImage* pImage)
 		return false;
 	}// if
 
-	for (int i = 0; i < width * height * 4; i += 4)
+	pImage->Sync();
+
+	for (int y = 0; y < height; y++)
 	{
-		unsigned char        rgb1[3];
-		unsigned char        rgb2[3];
+		unsigned char* row = data + y * stride;
+		unsigned char* otherRow = pImage->data + y * pImage->stride;
+
+		for (size_t i = 0; i < (size_t)width * 4; i += 4)
+		{
+			unsigned char        rgb1[3];
+			unsigned char        rgb2[3];
 
-		RGBA_To_RGB(data + i, rgb1);
-		RGBA_To_RGB(pImage->data + i, rgb2);
+			RGBA_To_RGB(row + i, rgb1);
+			RGBA_To_RGB(otherRow + i, rgb2);
 
-		data[i] = abs(rgb1[0] - rgb2[0]);
-		data[i + 1] = abs(rgb1[1] - rgb2[1]);
-		data[i + 2] = abs(rgb1[2] - rgb2[2]);
-		data[i + 3] = 255;
+			row[i] = abs(rgb1[0] - rgb2[0]);
+			row[i + 1] = abs(rgb1[1] - rgb2[1]);
+			row[i + 2] = abs(rgb1[2] - rgb2[2]);
+			row[i + 3] = 255;
+		}
 	}
 
 	return true;
@@ -944,60 +2208,23 @@ bool TargaImage::Difference(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Filter_Box()
 {
-	int Box_mask[5][5];
-	int sum[3] = { 0 };
-	for (int i = 0; i < 5; i++)
-	{
-		for (int j = 0; j < 5; j++)
-		{
-			Box_mask[i][j] = 1;
-		}
-	}
-	//cout  << "box_mask[3][3] : " << Box_mask[3][3] << endl;
-	for (int y = 0; y < height; y++)
-	{
-		for (int x = 0; x < width; x++)
-		{
-			for (int i = 0; i < 3; i++)
-			{
-				sum[i] = 0;
-			}
-			for (int i = -2; i < 3; i++)
-			{
-				for (int j = -2; j < 3; j++)
-				{
-					if (y + i < 0 || y + i >= height)
-					{
-						continue;
-					}
-					if (x + j < 0 || x + j >= width)
-					{
-						continue;
-					}
-					unsigned char* d = Get_RGBA(x + j, y + i, data);
-					sum[RED] += (d[RED] * Box_mask[2 + i][2 + j]);
-					sum[GREEN] += (d[GREEN] * Box_mask[2 + i][2 + j]);
-					sum[BLUE] += (d[BLUE] * Box_mask[2 + i][2 + j]);
-
-				}
-
-			}
-			unsigned char* nowD = Get_RGBA(x, y, data);
-			// cout << "sum(red): " << sum[RED] << endl;
-			nowD[RED] = sum[RED] / 25;
-			nowD[GREEN] = sum[GREEN] / 25;
-			nowD[BLUE] = sum[BLUE] / 25;
-
-
-		}
-
-
-	}
+	return Filter_Box_N(5);
+}// Filter_Box
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform NxN box filter on this image.  It costs the same per pixel 
+//  whatever N is, so wide boxes are cheap.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Box_N(unsigned int N)
+{
+	if (N > 0)
+		Filter_Box_Sums(N);
 
 	return true;
-}// Filter_Box
+}// Filter_Box_N
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1008,52 +2235,10 @@ bool TargaImage::Filter_Box()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Filter_Bartlett()
 {
-	double Box_mask[5][5] = { {1, 2, 3, 2, 1},
-						{2, 4, 6, 4, 2},
-						{3, 6, 9, 6, 3},
-						{2, 4, 6, 4, 2},
-						{1, 2, 3, 2, 1}, };
-	int sum[3] = { 0 };
-	//cout  << "box_mask[3][3] : " << Box_mask[3][3] << endl;
-	for (int y = 0; y < height; y++)
-	{
-		for (int x = 0; x < width; x++)
-		{
-			for (int i = 0; i < 3; i++)
-			{
-				sum[i] = 0;
-			}
-			for (int i = -2; i < 3; i++)
-			{
-				for (int j = -2; j < 3; j++)
-				{
-					if (y + i < 0 || y + i >= height)
-					{
-						continue;
-					}
-					if (x + j < 0 || x + j >= width)
-					{
-						continue;
-					}
-					unsigned char* d = Get_RGBA(x + j, y + i, data);
-					sum[RED] += (d[RED] * Box_mask[2 + i][2 + j]);
-					sum[GREEN] += (d[GREEN] * Box_mask[2 + i][2 + j]);
-					sum[BLUE] += (d[BLUE] * Box_mask[2 + i][2 + j]);
-
-				}
-
-			}
-			unsigned char* nowD = Get_RGBA(x, y, data);
-			// cout << "sum(red): " << sum[RED] << endl;
-			nowD[RED] = sum[RED] / 81;
-			nowD[GREEN] = sum[GREEN] / 81;
-			nowD[BLUE] = sum[BLUE] / 81;
-
-
-		}
-
+	// 1 2 3 2 1 across and down
+	const float kernel[5] = { 1 / 9.f, 2 / 9.f, 3 / 9.f, 2 / 9.f, 1 / 9.f };
 
-	}
+	Filter_Separable(kernel, 5);
 
 	return false;
 }// Filter_Bartlett
@@ -1067,53 +2252,10 @@ bool TargaImage::Filter_Bartlett()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Filter_Gaussian()
 {
-	int Box_mask[5][5] = { {1, 4, 6, 4, 1},
-						   {4, 16, 24, 16, 4},
-						   {6, 24, 36, 24, 6},
-						   {4, 16, 24, 16, 4},
-						   {1, 4, 6, 4, 1}, };
-	int sum[3] = { 0 };
-
-	//cout  << "box_mask[3][3] : " << Box_mask[3][3] << endl;
-	for (int y = 0; y < height; y++)
-	{
-		for (int x = 0; x < width; x++)
-		{
-			for (int i = 0; i < 3; i++)
-			{
-				sum[i] = 0;
-			}
-			for (int i = -2; i < 3; i++)
-			{
-				for (int j = -2; j < 3; j++)
-				{
-					if (y + i < 0 || y + i >= height)
-					{
-						continue;
-					}
-					if (x + j < 0 || x + j >= width)
-					{
-						continue;
-					}
-					unsigned char* d = Get_RGBA(x + j, y + i, data);
-					sum[RED] += (d[RED] * Box_mask[2 + i][2 + j]);
-					sum[GREEN] += (d[GREEN] * Box_mask[2 + i][2 + j]);
-					sum[BLUE] += (d[BLUE] * Box_mask[2 + i][2 + j]);
-
-				}
-
-			}
-			unsigned char* nowD = Get_RGBA(x, y, data);
-			// cout << "sum(red): " << sum[RED] << endl;
-			nowD[RED] = sum[RED] / 256;
-			nowD[GREEN] = sum[GREEN] / 256;
-			nowD[BLUE] = sum[BLUE] / 256;
-
+	// 1 4 6 4 1 across and down
+	const float kernel[5] = { 1 / 16.f, 4 / 16.f, 6 / 16.f, 4 / 16.f, 1 / 16.f };
 
-		}
-
-
-	}
+	Filter_Separable(kernel, 5);
 
 	return true;
 }// Filter_Gaussian
@@ -1127,92 +2269,27 @@ bool TargaImage::Filter_Gaussian()
 
 bool TargaImage::Filter_Gaussian_N(unsigned int N)
 {
-	vector<int> firstLine;
-	vector< vector <int> > mask;
+	vector<double> firstLine;
 	firstLine.assign(N, 0);
-	mask.assign(N, firstLine);
-	int sum[3] = { 0 };
-	int maskSum = 0;
-	int distance = N / 2; // 䪺Z
+	double lineSum = 0;
 	for (int i = 0; i < N; i++)
 	{
 		firstLine[i] = Binomial(N - 1, i);
+		lineSum += firstLine[i];
 	}
-	// build first colume and row
-	for (int i = 0; i < N; i++)
-	{
-		mask[0][i] = firstLine[i];
-		mask[i][0] = firstLine[i];
-	}
-	for (int i = 1; i < N; i++)
-	{
-		for (int j = 1; j < N; j++)
-		{
-			mask[i][j] = mask[0][j] * mask[i][0];
-		}
-
-	}
-	// for count sum
-	for (int i = 0; i < N; i++)
-	{
-		for (int j = 0; j < N; j++)
-		{
-			maskSum += mask[i][j];
-		}
+	// the mask is the outer product of the first line with itself, so its
+	// sum is the line's squared
+	cout << "mask sum : " << lineSum * lineSum << endl;
 
-	}
-	cout << "mask sum : " << maskSum << endl;
-	// look gauss mask
-	/*cout << "gauss mask : \n";
+	vector<float> kernel;
+	kernel.assign(N, 0);
 	for (int i = 0; i < N; i++)
 	{
-		for (int j = 0; j < N; j++)
-		{
-			cout << mask[i][j] << " ";
-		}
-		cout << endl;
-	}*/
-	for (int y = 0; y < height; y++)
-	{
-		for (int x = 0; x < width; x++)
-		{
-			for (int i = 0; i < 3; i++)
-			{
-				sum[i] = 0;
-			}
-			for (int i = -distance; i <= distance; i++)
-			{
-				for (int j = -distance; j <= distance; j++)
-				{
-					if (y + i < 0 || y + i >= height)
-					{
-						continue;
-					}
-					if (x + j < 0 || x + j >= width)
-					{
-						continue;
-					}
-					unsigned char* d = Get_RGBA(x + j, y + i, data);
-					sum[RED] += (d[RED] * mask[distance + i][distance + j]);
-					sum[GREEN] += (d[GREEN] * mask[distance + i][distance + j]);
-					sum[BLUE] += (d[BLUE] * mask[distance + i][distance + j]);
-
-				}
-
-			}
-			unsigned char* nowD = Get_RGBA(x, y, data);
-			// cout << "sum(red): " << sum[RED] << endl;
-			nowD[RED] = sum[RED] / maskSum;
-			nowD[GREEN] = sum[GREEN] / maskSum;
-			nowD[BLUE] = sum[BLUE] / maskSum;
-
-
-		}
-
-
+		kernel[i] = (float)(firstLine[i] / lineSum);
 	}
 
-
+	if (N > 0)
+		Filter_Separable(&kernel[0], N);
 
 	return true;
 }// Filter_Gaussian_N
@@ -1263,68 +2340,7 @@ bool TargaImage::Filter_Edge()
 		cout << endl;
 	}
 
-	int sum[3] = { 0 };
-	for (int turn = 0; turn < 3; turn++)
-	{
-		for (int y = 0; y < height; y++)
-		{
-			for (int x = 0; x < width; x++)
-			{
-				for (int i = 0; i < 3; i++)
-				{
-					sum[i] = 0;
-				}
-				for (int i = -2; i < 3; i++)
-				{
-					for (int j = -2; j < 3; j++)
-					{
-						if (y + i < 0 || y + i >= height)
-						{
-							continue;
-						}
-						if (x + j < 0 || x + j >= width)
-						{
-							continue;
-						}
-						unsigned char* d = Get_RGBA(x + j, y + i, data);
-						sum[RED] += (d[RED] * highPassMask[2 + i][2 + j]);
-						sum[GREEN] += (d[GREEN] * highPassMask[2 + i][2 + j]);
-						sum[BLUE] += (d[BLUE] * highPassMask[2 + i][2 + j]);
-
-					}
-
-				}
-				unsigned char* nowD = Get_RGBA(x, y, data);
-				// cout << "sum(red): " << sum[RED] << endl;
-				if (sum[RED] / BartlletSum > 255)
-					nowD[RED] = 255;
-				else if (sum[RED] / BartlletSum < 0)
-					nowD[RED] = 0;
-				else
-					nowD[RED] = sum[RED] / BartlletSum;
-
-				if (sum[GREEN] / BartlletSum > 255)
-					nowD[GREEN] = 255;
-				else if (sum[GREEN] / BartlletSum < 0)
-					nowD[GREEN] = 0;
-				else
-					nowD[GREEN] = sum[GREEN] / BartlletSum;
-
-				if (sum[BLUE] / BartlletSum > 255)
-					nowD[BLUE] = 255;
-				else if (sum[BLUE] / BartlletSum < 0)
-					nowD[BLUE] = 0;
-				else
-					nowD[BLUE] = sum[BLUE] / BartlletSum;
-
-
-
-
-			}
-
-
-		}
-	}
+	Filter_Planes(&highPassMask[0][0], 5, BartlletSum, true, 3);
 
 	return true;
 }// Filter_Edge
@@ -1364,66 +2380,7 @@ bool TargaImage::Filter_Enhance()
 
 	}
 
-	int sum[3] = { 0 };
-
-	for (int y = 0; y < height; y++)
-	{
-		for (int x = 0; x < width; x++)
-		{
-			for (int i = 0; i < 3; i++)
-			{
-				sum[i] = 0;
-			}
-			for (int i = -2; i < 3; i++)
-			{
-				for (int j = -2; j < 3; j++)
-				{
-					if (y + i < 0 || y + i >= height)
-					{
-						continue;
-					}
-					if (x + j < 0 || x + j >= width)
-					{
-						continue;
-					}
-					unsigned char* d = Get_RGBA(x + j, y + i, data);
-					sum[RED] +=  (d[RED] * highPassMask[2 + i][2 + j]);
-					sum[GREEN] +=  (d[GREEN] * highPassMask[2 + i][2 + j]);
-					sum[BLUE] += (d[BLUE] * highPassMask[2 + i][2 + j]);
-
-				}
-
-			}
-			unsigned char* nowD = Get_RGBA(x, y, data);
-			// cout << "sum(red): " << sum[RED] << endl;
-			if (sum[RED] / BartlletSum > 255)
-				nowD[RED] = 255;
-			else if (sum[RED] / BartlletSum < 0)
-				nowD[RED] = 0;
-			else
-				nowD[RED] = sum[RED] / BartlletSum;
-
-			if (sum[GREEN] / BartlletSum > 255)
-				nowD[GREEN] = 255;
-			else if (sum[GREEN] / BartlletSum < 0)
-				nowD[GREEN] = 0;
-			else
-				nowD[GREEN] = sum[GREEN] / BartlletSum;
-
-			if (sum[BLUE] / BartlletSum > 255)
-				nowD[BLUE] = 255;
-			else if (sum[BLUE] / BartlletSum < 0)
-				nowD[BLUE] = 0;
-			else
-				nowD[BLUE] = sum[BLUE] / BartlletSum;
-
-
-
-
-		}
-
-
-	}
+	Filter_Planes(&highPassMask[0][0], 5, BartlletSum, true);
 
 	return false;
 }// Filter_Enhance
@@ -1439,6 +2396,8 @@ bool TargaImage::Filter_Enhance()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::NPR_Paint()
 {
+	Unshare();
+
 	ClearToBlack();
 	return false;
 }
@@ -1454,6 +2413,12 @@ bool TargaImage::NPR_Paint()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Half_Size()
 {
+	// a view's pixels belong to another image, so it can't change size
+	if (borrowed)
+		return false;
+
+	Unshare();
+
 	float mask[][3] = { {0.0625, 0.1250, 0.0625},
 						{0.1250, 0.2500, 0.1250},
 						{0.0625, 0.1250, 0.0625} };
@@ -1493,12 +2458,8 @@ bool TargaImage::Half_Size()
 		}
 
 	}
-	// delete data , then make new data (need temp data to catch old data
-	unsigned char* temp_Data = new unsigned char[width * height * 4];
-	memcpy(temp_Data, data, width * height * 4);
-	delete[]data;
-	data = new unsigned char[width / 2 * height / 2 * 4];
-	memset(data, 0, (width / 2) * (height / 2) * 4);
+	// build the half size image beside this one, then swap it in
+	TargaImage half(width / 2, height / 2);
 	for (int y = 0; y < height; y++)
 	{
 		for (int x = 0; x < width; x++)
@@ -1512,8 +2473,8 @@ bool TargaImage::Half_Size()
 				continue;
 			}
 
-			unsigned char* Data_RGBA = &data[int(x / 2) * 4 + int(y / 2) * int(width / 2) * 4];
-			unsigned char* TData_RGBA = Get_RGBA(x, y, temp_Data);
+			unsigned char* Data_RGBA = &half.data[int(x / 2) * 4 + (size_t)(y / 2) * half.stride];
+			unsigned char* TData_RGBA = &data[x * 4 + (size_t)y * stride];
 			Data_RGBA[RED] = TData_RGBA[RED];
 			Data_RGBA[GREEN] = TData_RGBA[GREEN];
 			Data_RGBA[BLUE] = TData_RGBA[BLUE];
@@ -1523,14 +2484,11 @@ bool TargaImage::Half_Size()
 		}
 
 	}
-	width /= 2;
-	height /= 2;
+	half.depth = depth;
+	*this = std::move(half);
 	// change widget size
 
 
-	delete[]temp_Data;
-
-
 	return false;
 }// Half_Size
 
@@ -1618,7 +2576,7 @@ void TargaImage::RGBA_To_RGB(unsigned char* rgba, unsigned char* rgb)
 ///////////////////////////////////////////////////////////////////////////////
 unsigned char* TargaImage::Get_RGBA(int x, int y, unsigned char* D)
 {
-	unsigned char* pos = &D[x * 4 + y * width * 4];
+	unsigned char* pos = &D[x * 4 + (size_t)y * stride];
 	return pos;
 }
 
@@ -1632,30 +2590,21 @@ unsigned char* TargaImage::Get_RGBA(int x, int y, unsigned char* D)
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage* TargaImage::Reverse_Rows(void)
 {
-	unsigned char* dest = new unsigned char[width * height * 4];
-	TargaImage* result;
-	int 	        i, j;
-
 	if (!data)
 		return NULL;
 
-	for (i = 0; i < height; i++)
-	{
-		int in_offset = (height - i - 1) * width * 4;
-		int out_offset = i * width * 4;
+	Sync();
 
-		for (j = 0; j < width; j++)
-		{
-			dest[out_offset + j * 4] = data[in_offset + j * 4];
-			dest[out_offset + j * 4 + 1] = data[in_offset + j * 4 + 1];
-			dest[out_offset + j * 4 + 2] = data[in_offset + j * 4 + 2];
-			dest[out_offset + j * 4 + 3] = data[in_offset + j * 4 + 3];
-		}
+	// rows go straight into the new image's buffer
+	size_t destStride = Row_Stride(width);
+	unsigned char* dest = Alloc_Pixels(destStride * height);
+	for (int i = 0; i < height; i++)
+	{
+		memcpy(dest + i * destStride, data + (size_t)(height - i - 1) * stride, (size_t)width * 4);
+		memset(dest + i * destStride + (size_t)width * 4, 0, destStride - (size_t)width * 4);
 	}
 
-	result = new TargaImage(width, height, dest);
-	delete[] dest;
-	return result;
+	return new TargaImage(width, height, dest, destStride);
 }// Reverse_Rows
 
 
@@ -1666,7 +2615,10 @@ TargaImage* TargaImage::Reverse_Rows(void)
 ///////////////////////////////////////////////////////////////////////////////
 void TargaImage::ClearToBlack()
 {
-	memset(data, 0, width * height * 4);
+	Unshare();
+
+	for (int i = 0; i < height; i++)
+		memset(data + i * stride, 0, (size_t)width * 4);
 }// ClearToBlack
 
 
@@ -1746,6 +2698,8 @@ bool TargaImage::Boundry_Check(int x, int y)
 //
 ///////////////////////////////////////////////////////////////////////////////
 void TargaImage::Paint_Stroke(const Stroke& s) {
+	Unshare();
+
 	int radius_squared = (int)s.radius * (int)s.radius;
 	for (int x_off = -((int)s.radius); x_off <= (int)s.radius; x_off++) {
 		for (int y_off = -((int)s.radius); y_off <= (int)s.radius; y_off++) {
@@ -1755,20 +2709,20 @@ void TargaImage::Paint_Stroke(const Stroke& s) {
 			if ((x_loc >= 0 && x_loc < width && y_loc >= 0 && y_loc < height)) {
 				int dist_squared = x_off * x_off + y_off * y_off;
 				if (dist_squared <= radius_squared) {
-					data[(y_loc * width + x_loc) * 4 + 0] = s.r;
-					data[(y_loc * width + x_loc) * 4 + 1] = s.g;
-					data[(y_loc * width + x_loc) * 4 + 2] = s.b;
-					data[(y_loc * width + x_loc) * 4 + 3] = s.a;
+					data[(size_t)y_loc * stride + x_loc * 4 + 0] = s.r;
+					data[(size_t)y_loc * stride + x_loc * 4 + 1] = s.g;
+					data[(size_t)y_loc * stride + x_loc * 4 + 2] = s.b;
+					data[(size_t)y_loc * stride + x_loc * 4 + 3] = s.a;
 				}
 				else if (dist_squared == radius_squared + 1) {
-					data[(y_loc * width + x_loc) * 4 + 0] =
-						(data[(y_loc * width + x_loc) * 4 + 0] + s.r) / 2;
-					data[(y_loc * width + x_loc) * 4 + 1] =
-						(data[(y_loc * width + x_loc) * 4 + 1] + s.g) / 2;
-					data[(y_loc * width + x_loc) * 4 + 2] =
-						(data[(y_loc * width + x_loc) * 4 + 2] + s.b) / 2;
-					data[(y_loc * width + x_loc) * 4 + 3] =
-						(data[(y_loc * width + x_loc) * 4 + 3] + s.a) / 2;
+					data[(size_t)y_loc * stride + x_loc * 4 + 0] =
+						(data[(size_t)y_loc * stride + x_loc * 4 + 0] + s.r) / 2;
+					data[(size_t)y_loc * stride + x_loc * 4 + 1] =
+						(data[(size_t)y_loc * stride + x_loc * 4 + 1] + s.g) / 2;
+					data[(size_t)y_loc * stride + x_loc * 4 + 2] =
+						(data[(size_t)y_loc * stride + x_loc * 4 + 2] + s.b) / 2;
+					data[(size_t)y_loc * stride + x_loc * 4 + 3] =
+						(data[(size_t)y_loc * stride + x_loc * 4 + 3] + s.a) / 2;
 				}
 			}
 		}
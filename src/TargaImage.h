@@ -19,6 +19,7 @@
 
 class Stroke;
 class DistanceImage;
+class PlanarImage;
 
 typedef struct Color
 {
@@ -30,6 +31,30 @@ typedef struct Color
 
 }c;
 
+typedef struct ImageInfo    // what Probe learns about an image file without decoding it
+{
+    int width = 0;
+    int height = 0;
+    int depth = 0;          // bits per pixel as stored, colormap indices for paletted files
+    int alphaBits = 0;
+    bool bRLE = false;
+    bool bPaletted = false;
+
+}ImageInfo;
+
+typedef struct ImageView    // a rectangle of some image's pixels, borrowed rather than owned
+{
+    unsigned char* data = NULL;     // the top left pixel, pre-multiplied RGBA
+    int width = 0;
+    int height = 0;
+    size_t stride = 0;              // bytes from the start of one row to the next
+
+    // how far the image goes on past the left, top, right and bottom of the rectangle.
+    // Filters read their neighborhoods from there, but only the rectangle is written
+    int margin[4] = { 0, 0, 0, 0 };
+
+}ImageView;
+
 class TargaImage
 {
     // methods
@@ -37,12 +62,42 @@ class TargaImage
 	    TargaImage(void);
             TargaImage(int w, int h);
 	    TargaImage(int w, int h, unsigned char *d);
+            TargaImage(int w, int h, unsigned char* d, size_t stride);  // adopt d, from Alloc_Pixels, without copying
             TargaImage(const TargaImage& image);
+            TargaImage(TargaImage&& image);             // take image's pixels, leaving it empty
+            explicit TargaImage(const ImageView& view); // operate on a view in place; the pixels aren't owned
 	    ~TargaImage(void);
 
+        TargaImage& operator=(const TargaImage& image);
+        TargaImage& operator=(TargaImage&& image);
+
+        static unsigned char* Alloc_Pixels(size_t size);    // memory for pixels with aligned rows, pooled.  Throws bad_alloc
+        static void Free_Pixels(unsigned char* pixels);     // give memory from Alloc_Pixels back to the pool
+        static size_t Row_Stride(int w);                    // the stride images w pixels wide get
+
+        void Unshare();                             // call before writing to data; copies share pixels until then
+        void Sync();                                // call before reading data; filters leave it behind in a working copy
+        bool Set_Depth(int bits);                   // bits per channel the filters work in:  16, or 32 for float.  False if unsupported
+        int Depth() const;
+
         unsigned char*	To_RGB(void);	            // Convert the image to RGB format,
-        bool Save_Image(const char*);               // save the image to a file
+        bool Save_Image(const char*, bool bRLE = false);    // save the image to a file, optionally run-length encoded
+        bool Save_Image(std::vector<unsigned char>&, bool bRLE = false);  // encode the image as a targa file in memory
         static TargaImage* Load_Image(char*);       // Load a file and return a pointer to a new TargaImage object.  Returns NULL on failure
+        static TargaImage* Load_Image(const unsigned char*, size_t);  // Same, from a buffer holding a whole targa file
+        static bool Probe(const char*, ImageInfo& info);   // read just a file's header.  Returns false on failure
+        // a view of the whole image, or of a rectangle of it clipped to it, to write through.  A view
+        // is good until the image is next changed, copied, assigned or destroyed:  a copy shares
+        // the pixels, so writes through an older view would show up in both
+        ImageView View();
+        ImageView View(int x, int y, int w, int h);
+        bool Save_RGBA(const char*);                // save to our own raw RGBA container, which has no 64K size limit
+        static TargaImage* Load_RGBA(const char*);  // load from that container.  Load_Image recognizes it too
+
+        // run a point operation (one that looks at each pixel alone, like To_Grayscale) over a file
+        // a band of rows at a time and write the result, so the whole image is never in memory
+        static bool Process_Bands(const char* sIn, const char* sOut, bool (TargaImage::*pOperation)(),
+                                  int nBandRows = 256, bool bRLE = false);
 
         bool To_Grayscale();
 
@@ -66,6 +121,7 @@ class TargaImage
         bool Difference(TargaImage* pImage);
 
         bool Filter_Box();
+        bool Filter_Box_N(unsigned int N);
         bool Filter_Bartlett();
         bool Filter_Gaussian();
         bool Filter_Gaussian_N(unsigned int N);
@@ -87,6 +143,31 @@ class TargaImage
         // helper to get RGBA format
         unsigned char* Get_RGBA(int x, int y , unsigned char* D);
 
+        // does the file start with the raw RGBA container's signature
+        static bool Is_RGBA_File(const char* filename);
+        // read that container's header, giving its width and height
+        static bool Read_RGBA_Header(FILE* file, unsigned long long& w, unsigned long long& h,
+                                     unsigned long long& stride);
+
+        // give data aligned, padded rows for a w x h image and set stride
+        void Alloc_Data(int w, int h);
+        // release data, unmapping it if it came from a file
+        void Free_Data();
+        // copy mapped data to memory of our own
+        void Own_Data();
+        // run a convolution filter on the working copy of the image, passes times over
+        void Filter_Planes(const int* mask, int size, int divisor, bool bClamp, int passes = 1);
+        // run a separable one, a row pass and a column pass of kernel
+        void Filter_Separable(const float* kernel, int size);
+        // run a size x size box filter with running sums
+        void Filter_Box_Sums(int size);
+        // make the working copy if there isn't one at the image's depth, reaching radius
+        // pixels past a view's edges where the image it came from has them
+        void Make_Planes(int radius);
+        // reference counting for memory from Alloc_Pixels
+        static void Share_Pixels(unsigned char* pixels);
+        static bool Pixels_Shared(unsigned char* pixels);
+
         // reverse the rows of the image, some targas are stored bottom to top
 	TargaImage* Reverse_Rows(void);
 
@@ -108,6 +189,18 @@ class TargaImage
         int		width;	    // width of the image in pixels
         int		height;	    // height of the image in pixels
         unsigned char	*data;	    // pixel data for the image, assumed to be in pre-multiplied RGBA format.
+        size_t		stride;	    // bytes from the start of one row of data to the next; rows are 64-byte aligned
+
+    private:
+        void*		mapping = NULL;	    // the file data is mapped copy-on-write from, NULL if data is allocated
+        size_t		mappingSize = 0;
+        bool		borrowed = false;   // data belongs to another image, this is a view of it
+        int		margin[4] = { 0, 0, 0, 0 };    // for a view, how far that image goes on past each edge, as in ImageView
+        PlanarImage*	planes = NULL;	    // working copy the filters chain through, until data is synced
+        bool		planesNewer = false;    // planes hold changes data doesn't have yet
+        int		planesX = 0;	    // where data's top left pixel is in the planes, which start
+        int		planesY = 0;	    // that far into a view's margin
+        int		depth = 32;	    // bits per channel of the planes the filters make
 
 };
 
@@ -2,8 +2,37 @@
 ** libtarga.c -- routines for reading targa files.
 */
 
+#ifndef _WIN32
+#define _FILE_OFFSET_BITS 64            // 64-bit file offsets on 32-bit systems too
+#define _POSIX_C_SOURCE 200112L         // for fseeko and ftello
+#endif
+
 #include <stdio.h>
 #include <malloc.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#endif
+
+/* x86-64 always has SSE2; SSSE3 is checked for at run time. */
+#if defined( _M_X64 ) || defined( __x86_64__ )
+#define TGA_SSE2
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TGA_TARGET_SSSE3
+#else
+#define TGA_TARGET_SSSE3 __attribute__(( target( "ssse3" ) ))
+#endif
+#endif
 
 #include "libtarga.h"
 
@@ -51,22 +80,219 @@
 #define TGA_ERR_READ_FAILS              (9)
 #define TGA_ERR_BAD_IMAGE_TYPE          (10)
 #define TGA_ERR_BAD_DIMENSIONS          (11)
+#define TGA_ERR_CANNOT_MAP              (12)
+#define TGA_ERR_WRITE_FAILS             (13)
+#define TGA_ERR_MISSING_ROWS            (14)
+#define TGA_ERR_TOO_BIG                 (15)
+#define TGA_ERR_NO_MEMORY               (16)
+
+
+#define TGA_READ_CHUNK           (64 * 1024)
+
+
+/* run-length encoding is split across threads for images at least this many 
+   pixels big, in bands of at least TGA_RLE_MIN_ROWS rows. */
+#define TGA_RLE_PARALLEL_PIXELS  (512 * 1024)
+#define TGA_RLE_MIN_ROWS         (16)
+#define TGA_RLE_MAX_THREADS      (64)
+
+
+/* row conversion kernels, picked once per file. */
+#define TGA_KERNEL_GENERIC       (0)     // tga_convert_color a pixel at a time
+#define TGA_KERNEL_LUT16         (1)     // 15/16-bit pixels through a 64K table
+#define TGA_KERNEL_BGR           (2)     // opaque 24/32-bit, swap red and blue
+#define TGA_KERNEL_BGRA          (3)     // 32-bit with alpha, swap and premultiply
+#define TGA_KERNEL_PALETTE       (4)     // colormap indices through the finished colormap
+
+
+/* file offsets -- targas over 2GB are quite possible, and long is only 32 bits on Windows. */
+#ifdef _WIN32
+typedef __int64 tga_off;
+#define tga_fseek _fseeki64
+#define tga_ftell _ftelli64
+#else
+typedef off_t tga_off;
+#define tga_fseek fseeko
+#define tga_ftell ftello
+#endif
+
+
+/* buffered reader for the targa data -- keeps us from doing an fread per byte.
+   a memory reader is just one that starts with everything already buffered. */
+typedef struct {
+    FILE * file;                // NULL when reading from memory
+    const ubyte * buf;
+    ubyte * owned;              // our own chunk buffer, if we have one
+    size_t len;                 // valid bytes in buf
+    size_t pos;                 // next unread byte in buf
+} tga_reader;
+
+
+/* a read-only view of an uncompressed truecolor file. */
+typedef struct {
+    const ubyte * base;         // start of the mapping
+    size_t size;                // length of the mapping
+    const ubyte * pixels;       // first byte of pixel data
+    uint16 width;
+    uint16 height;
+    ubyte  pix_depth;
+    ubyte  img_desc;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} tga_map_view;
+
+
+/* where encoded data goes -- a file, or a growing block of memory. */
+typedef struct {
+    FILE * file;                // NULL when writing to memory
+    ubyte * buf;
+    size_t len;                 // bytes written to buf
+    size_t cap;                 // bytes allocated for buf
+    int failed;                 // the TGA_ERR code of a write gone wrong; everything after is dropped
+} tga_writer;
+
+
+/* a band of rows run-length encoded on a thread of its own.  packets never
+   span rows in what we write, so bands can simply be put one after another. */
+typedef struct {
+    const ubyte * dat;
+    uint32 width;
+    uint32 height;
+    size_t stride;              // bytes from one row of dat to the next
+    uint32 first;               // first file row of the band
+    uint32 rows;
+    uint32 format;
+    int    top_down;
+    tga_writer out;             // the band's packets, in memory
+} tga_rle_job;
+
+
+/* run-length packet state, carried across rows since packets may span them. */
+typedef struct {
+    uint32 remaining;           // pixels left in the current packet
+    int    is_run;              // current packet is a run (one pixel repeated)
+    ubyte  pixel[4];            // the repeated pixel for a run packet
+} tga_rle_state;
+
+
+/* how file pixels turn into RGB(A) in memory. */
+typedef struct {
+    int    kernel;              // one of the TGA_KERNEL constants
+    int    ssse3;               // the CPU can run the SSSE3 kernels
+    ubyte  bytes_per_pix;       // bytes per pixel in the file
+    ubyte  bpp_in;              // true bits per pixel, after the colormap
+    ubyte  alphabits;
+    uint32 format;              // bytes per pixel out
+    ubyte * lut;                // 4 bytes of finished pixel per 16-bit value, or per colormap index
+    uint32 lut_entries;
+} tga_converter;
+
+
+/* everything needed to decode the pixel rows once the header has been read. */
+typedef struct {
+    uint16 width;
+    uint16 height;
+    ubyte  img_desc;
+    ubyte  bytes_per_pix;       // bytes per pixel in the file
+    int    is_rle;
+    uint32 format;              // bytes per pixel out
+    tga_converter conv;
+    tga_rle_state rle_state;
+    ubyte * row_buf;            // one row as it comes out of the file
+    uint32 row_bytes;
+} tga_decoder;
+
+
+/* where a row starts in a run-length file -- the packet may have begun on an earlier row. */
+typedef struct {
+    tga_off offset;
+    tga_rle_state state;
+} tga_row_mark;
+
+
+/* a targa being read a band of rows at a time. */
+typedef struct {
+    FILE * file;
+    tga_reader reader;
+    tga_decoder dec;
+    int top_down;
+    uint32 next;                // next row to hand out
+    int reversed;               // the file holds the rows the other way round
+    tga_off data_start;         // file offset of the first row of pixels
+    tga_row_mark * marks;       // every row's start, for run-length files read backwards
+} tga_band_reader;
+
+
+/* a targa being written a band of rows at a time. */
+typedef struct {
+    tga_writer writer;
+    uint32 width;
+    uint32 height;
+    uint32 format;
+    int rle;
+    uint32 next;                // rows written so far
+    ubyte * row_buf;
+    ubyte * packet_buf;
+} tga_band_writer;
 
 
 static uint32 TargaError;
 
 
 static int16 ttohs( int16 val );
-static int16 htots( int16 val );
 static int32 ttohl( int32 val );
-static int32 htotl( int32 val );
 
 
-static uint32 tga_get_pixel( FILE * tga, ubyte bytes_per_pix, 
-                            ubyte * colormap, ubyte cmap_bytes_entry );
+static void tga_reader_init( tga_reader * reader, FILE * file );
+static void tga_reader_init_mem( tga_reader * reader, const ubyte * buf, size_t size );
+static uint32 tga_reader_read( tga_reader * reader, ubyte * dst, uint32 count );
+static int tga_reader_skip( tga_reader * reader, size_t count );
+static tga_off tga_reader_tell( tga_reader * reader );
+static int tga_reader_seek( tga_reader * reader, tga_off offset );
+static void tga_reader_free( tga_reader * reader );
+
+static void tga_writer_put( tga_writer * writer, const void * src, size_t count );
+
+static void tga_encode_rows( tga_writer * writer, const ubyte * dat, uint32 width, uint32 height, 
+                            size_t stride, uint32 first, uint32 rows, uint32 format, int rle, 
+                            int top_down );
+static void tga_encode_rle_parallel( tga_writer * writer, const ubyte * dat, uint32 width, 
+                                    uint32 height, size_t stride, uint32 format, int top_down );
+static int tga_cpu_count( void );
+#ifdef _WIN32
+static DWORD WINAPI tga_rle_thread( LPVOID arg );
+#else
+static void * tga_rle_thread( void * arg );
+#endif
+
+static void tga_read_row_unc( tga_reader * reader, ubyte * row, uint32 row_bytes, ubyte bytes_per_pix );
+static void tga_read_row_rle( tga_reader * reader, tga_rle_state * state, ubyte * row, 
+                             uint32 w, ubyte bytes_per_pix );
+
+static uint32 tga_row_index( ubyte img_desc, uint32 row, uint32 h, int top_down );
+static ubyte * tga_row_dest( ubyte * dat, ubyte img_desc, uint32 y, uint32 w, 
+                            uint32 format, size_t stride, int32 * dst_step );
+static int tga_converter_init( tga_converter * conv, ubyte bytes_per_pix, ubyte bpp_in, 
+                              ubyte alphabits, const ubyte * colormap, uint32 cmap_first, 
+                              uint32 cmap_length, ubyte cmap_bytes_entry, uint32 format );
+static void tga_converter_free( tga_converter * conv );
+static void tga_convert_row( const tga_converter * conv, const ubyte * src, ubyte * dst, 
+                            uint32 w, int32 dst_step );
+#ifdef TGA_SSE2
+static int tga_cpu_has_ssse3( void );
+static uint32 tga_convert_bgrx_sse2( const ubyte * src, ubyte * dst, uint32 w );
+static uint32 tga_convert_bgra_sse2( const ubyte * src, ubyte * dst, uint32 w );
+TGA_TARGET_SSSE3 static uint32 tga_convert_bgr_ssse3( const ubyte * src, ubyte * dst, uint32 w );
+#endif
+
+static uint32 tga_get_pixel( const ubyte * src, ubyte bytes_per_pix );
+static void tga_encode_pixel( const ubyte * src, ubyte * out, uint32 format );
+static void tga_encode_row( const ubyte * src, ubyte * out, uint32 w, uint32 format );
+static uint32 tga_rle_encode_row( const ubyte * pix, ubyte * out, uint32 w, uint32 format );
+static uint32 tga_pixel_word( const ubyte * pix, uint32 format );
 static uint32 tga_convert_color( uint32 pixel, uint32 bpp_in, ubyte alphabits, uint32 format_out );
-static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
-                                   uint32 w, uint32 h, uint32 pixel, uint32 format );
 
 
 /* returns the last error encountered */
@@ -116,6 +342,21 @@ const char * tga_error_string( int error_code ) {
     case TGA_ERR_BAD_DIMENSIONS:
         return( "image has size 0 width or height (or both)" );
 
+    case TGA_ERR_CANNOT_MAP:
+        return( "image cannot be mapped" );
+
+    case TGA_ERR_WRITE_FAILS:
+        return( "cannot write to file" );
+
+    case TGA_ERR_MISSING_ROWS:
+        return( "image is missing rows" );
+
+    case TGA_ERR_TOO_BIG:
+        return( "image is too big for a targa file" );
+
+    case TGA_ERR_NO_MEMORY:
+        return( "out of memory" );
+
     default:
         return( "unknown error" );
 
@@ -128,18 +369,20 @@ const char * tga_error_string( int error_code ) {
 
 
 /* creates a targa image of the desired format */
-void * tga_create( int width, int height, unsigned int format ) {
+void * tga_create_r( int width, int height, unsigned int format, int * error ) {
+
+    *error = TGA_ERR_NONE;
 
     switch( format ) {
         
     case TGA_TRUECOLOR_32:
-        return( (void *)malloc( width * height * 4 ) );
+        return( (void *)malloc( (size_t)width * height * 4 ) );
         
     case TGA_TRUECOLOR_24:
-        return( (void *)malloc( width * height * 3 ) );
+        return( (void *)malloc( (size_t)width * height * 3 ) );
         
     default:
-        TargaError = TGA_ERR_BAD_FORMAT;
+        *error = TGA_ERR_BAD_FORMAT;
         break;
 
     }
@@ -149,9 +392,8 @@ void * tga_create( int width, int height, unsigned int format ) {
 }
 
 
-/* loads and converts a targa from disk */
-void * tga_load( const char * filename, 
-                int * width, int * height, unsigned int format ) {
+/* reads the header and colormap and readies a decoder for the pixel rows */
+static int tga_decode_begin( tga_reader * reader, tga_decoder * dec, unsigned int format, int * error ) {
     
     ubyte  idlen;               // length of the image_id string below.
     ubyte  cmap_type;           // paletted image <=> cmap_type
@@ -166,39 +408,24 @@ void * tga_load( const char * filename,
     ubyte  img_spec_pix_depth;  // the depth of a pixel in the image.
     ubyte  img_spec_img_desc;   // the image descriptor.
 
-    FILE * targafile;
-
-    ubyte * tga_hdr = NULL;
+    ubyte tga_hdr[HDR_LENGTH];
 
     ubyte * colormap = NULL;
 
     ubyte cmap_bytes_entry = 0; // Prevents spurious debug runtime check in VC2003
     uint32 cmap_bytes;
-    
-    uint32 tmp_col;
-    uint32 tmp_int32;
-    ubyte  tmp_byte;
 
     ubyte alphabits = 0;
 
-    uint32 num_pixels;
-    
-    uint32 i;
-    uint32 j;
-
-    ubyte * image_data;
-    uint32 img_dat_len;
+    size_t num_pixels;
 
     ubyte bytes_per_pix;
 
-    ubyte true_bits_per_pixel;
-
-    uint32 bytes_total = 0;
-
-    ubyte packet_header;
-    ubyte repcount;
+    int is_rle;
     
 
+    *error = TGA_ERR_NONE;
+
     switch( format ) {
 
     case TGA_TRUECOLOR_24:
@@ -206,28 +433,22 @@ void * tga_load( const char * filename,
         break;
 
     default:
-        TargaError = TGA_ERR_BAD_FORMAT;
-        return( NULL );
+        *error = TGA_ERR_BAD_FORMAT;
+        return( 0 );
 
     }
 
-    
-    /* open binary image file */
-    targafile = fopen( filename, "rb" );
-    if( targafile == NULL ) {
-        TargaError = TGA_ERR_OPEN_FAILS;
-        return( NULL );
+    // a file reader that couldn't get its buffer.
+    if( reader->file != NULL && reader->owned == NULL ) {
+        *error = TGA_ERR_NO_MEMORY;
+        return( 0 );
     }
 
 
-    /* allocate memory for the header */
-    tga_hdr = (ubyte *)malloc( HDR_LENGTH );
-
     /* read the header in. */
-    if( fread( (void *)tga_hdr, 1, HDR_LENGTH, targafile ) != HDR_LENGTH ) {
-        free( tga_hdr );
-        TargaError = TGA_ERR_BAD_HEADER;
-        return( NULL );
+    if( tga_reader_read( reader, tga_hdr, HDR_LENGTH ) != HDR_LENGTH ) {
+        *error = TGA_ERR_BAD_HEADER;
+        return( 0 );
     }
 
     
@@ -248,14 +469,13 @@ void * tga_load( const char * filename,
     img_spec_pix_depth = (ubyte)tga_hdr[HDR_IMG_SPEC_PIX_DEPTH];
     img_spec_img_desc  = (ubyte)tga_hdr[HDR_IMG_SPEC_IMG_DESC];
 
-    free( tga_hdr );
-
 
-    num_pixels = img_spec_width * img_spec_height;
+    // 65535 x 65535 is a valid size, and overflows an int.
+    num_pixels = (size_t)img_spec_width * img_spec_height;
 
     if( num_pixels == 0 ) {
-        TargaError = TGA_ERR_BAD_DIMENSIONS;
-        return( NULL );
+        *error = TGA_ERR_BAD_DIMENSIONS;
+        return( 0 );
     }
 
     
@@ -264,17 +484,17 @@ void * tga_load( const char * filename,
     
     /* seek past the image id, if there is one */
     if( idlen ) {
-        if( fseek( targafile, idlen, SEEK_CUR ) ) {
-            TargaError = TGA_ERR_UNEXPECTED_EOF;
-            return( NULL );
+        if( !tga_reader_skip( reader, idlen ) ) {
+            *error = TGA_ERR_UNEXPECTED_EOF;
+            return( 0 );
         }
     }
 
 
     /* if this is a 'nodata' image, just jump out. */
     if( image_type == TGA_IMG_NODATA ) {
-        TargaError = TGA_ERR_NODATA_IMAGE;
-        return( NULL );
+        *error = TGA_ERR_NODATA_IMAGE;
+        return( 0 );
     }
 
 
@@ -294,13 +514,14 @@ void * tga_load( const char * filename,
         case TGA_IMG_RLE_TRUECOLOR:
             // this should really be an error, but some really old
             // crusty targas might actually be like this (created by TrueVision, no less!)
-            // so, we'll hack our way through it.
+            // so, we'll hack our way through it -- the pixels hold their own 
+            // colors, so the colormap is just skipped below.
             break;
             
         case TGA_IMG_UNC_GRAYSCALE:
         case TGA_IMG_RLE_GRAYSCALE:
-            TargaError = TGA_ERR_COLORMAP_FOR_GRAY;
-            return( NULL );
+            *error = TGA_ERR_COLORMAP_FOR_GRAY;
+            return( 0 );
         }
         
         /* ensure colormap entry size is something we support */
@@ -308,8 +529,8 @@ void * tga_load( const char * filename,
             cmap_entry_size == 16 ||
             cmap_entry_size == 24 ||
             cmap_entry_size == 32) ) {
-            TargaError = TGA_ERR_BAD_COLORMAP_ENTRY_SIZE;
-            return( NULL );
+            *error = TGA_ERR_BAD_COLORMAP_ENTRY_SIZE;
+            return( 0 );
         }
         
         
@@ -321,33 +542,24 @@ void * tga_load( const char * filename,
         }
         
         cmap_bytes = cmap_bytes_entry * cmap_length;
-        colormap = (ubyte *)malloc( cmap_bytes );
-        
-        
-        for( i = 0; i < cmap_length; i++ ) {
-            
-            /* seek ahead to first entry used */
-            if( cmap_first != 0 ) {
-                fseek( targafile, cmap_first * cmap_bytes_entry, SEEK_CUR );
-            }
-            
-            tmp_int32 = 0;
-            for( j = 0; j < cmap_bytes_entry; j++ ) {
-                if( !fread( &tmp_byte, 1, 1, targafile ) ) {
-                    free( colormap );
-                    TargaError = TGA_ERR_BAD_COLORMAP;
-                    return( NULL );
-                }
-                tmp_int32 += tmp_byte << (j * 8);
-            }
 
-            // byte order correct.
-            tmp_int32 = ttohl( tmp_int32 );
+        if( image_type == TGA_IMG_UNC_PALETTED || image_type == TGA_IMG_RLE_PALETTED ) {
 
-            for( j = 0; j < cmap_bytes_entry; j++ ) {
-                colormap[i * cmap_bytes_entry + j] = (tmp_int32 >> (8 * j)) & 0xFF;
+            // the file holds entries cmap_first on, one after the other.
+            colormap = (ubyte *)malloc( cmap_bytes );
+            if( colormap == NULL ) {
+                *error = TGA_ERR_NO_MEMORY;
+                return( 0 );
             }
-            
+            if( tga_reader_read( reader, colormap, cmap_bytes ) != cmap_bytes ) {
+                free( colormap );
+                *error = TGA_ERR_BAD_COLORMAP;
+                return( 0 );
+            }
+
+        } else if( !tga_reader_skip( reader, cmap_bytes ) ) {
+            *error = TGA_ERR_BAD_COLORMAP;
+            return( 0 );
         }
 
     }
@@ -367,671 +579,1986 @@ void * tga_load( const char * filename,
     }
 
 
-    /* compute how many bytes of storage we need for the image */
-    bytes_total = img_spec_width * img_spec_height * format;
-
-    image_data = (ubyte *)malloc( bytes_total );
-
-    img_dat_len = img_spec_width * img_spec_height * bytes_per_pix;
-
-    // compute the true number of bits per pixel
-    true_bits_per_pixel = cmap_type ? cmap_entry_size : img_spec_pix_depth;
-
     switch( image_type ) {
 
     case TGA_IMG_UNC_TRUECOLOR:
     case TGA_IMG_UNC_GRAYSCALE:
     case TGA_IMG_UNC_PALETTED:
-
-        /* FIXME: support grayscale */
-
-        for( i = 0; i < num_pixels; i++ ) {
-
-            // get the color value.
-            tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
-            tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
-            
-            // now write the data out.
-            tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
-                i, img_spec_width, img_spec_height, tmp_col, format );
-
-        }
-    
+        is_rle = 0;
         break;
 
-
     case TGA_IMG_RLE_TRUECOLOR:
     case TGA_IMG_RLE_GRAYSCALE:
     case TGA_IMG_RLE_PALETTED:
+        is_rle = 1;
+        break;
 
-        // FIXME: handle grayscale..
-
-        for( i = 0; i < num_pixels; ) {
+    default:
+        free( colormap );
+        *error = TGA_ERR_BAD_IMAGE_TYPE;
+        return( 0 );
 
-            /* a bit of work to do to read the data.. */
-            if( fread( &packet_header, 1, 1, targafile ) < 1 ) {
-                // well, just let them fill the rest with null pixels then...
-                packet_header = 1;
-            }
+    }
 
-            if( packet_header & 0x80 ) {
-                /* run length packet */
-
-                tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
-                tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
-                
-                repcount = (packet_header & 0x7F) + 1;
-                
-                /* write all the data out */
-                for( j = 0; j < repcount; j++ ) {
-                    tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
-                        i + j, img_spec_width, img_spec_height, tmp_col, format );
-                }
 
-                i += repcount;
-
-            } else {
-                /* raw packet */
-                /* get pixel from file */
-                
-                repcount = (packet_header & 0x7F) + 1;
-                
-                for( j = 0; j < repcount; j++ ) {
-                    
-                    tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
-                    tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
-                    
-                    tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
-                        i + j, img_spec_width, img_spec_height, tmp_col, format );
+    dec->width          = img_spec_width;
+    dec->height         = img_spec_height;
+    dec->img_desc       = img_spec_img_desc;
+    dec->bytes_per_pix  = bytes_per_pix;
+    dec->is_rle         = is_rle;
+    dec->format         = format;
+
+    // the true number of bits per pixel comes from the colormap, if there is one.
+    // the converter keeps its own finished copy of the colormap.
+    if( !tga_converter_init( &dec->conv, bytes_per_pix, colormap ? cmap_entry_size : img_spec_pix_depth, 
+            alphabits, colormap, cmap_first, cmap_length, cmap_bytes_entry, format ) ) {
+        tga_converter_free( &dec->conv );
+        free( colormap );
+        *error = TGA_ERR_NO_MEMORY;
+        return( 0 );
+    }
+    free( colormap );
 
-                }
+    /* FIXME: support grayscale */
 
-                i += repcount;
+    // the pixel data is pulled through the reader one row at a time,
+    // then converted by a kernel picked for the pixel depth.
+    dec->row_bytes = img_spec_width * bytes_per_pix;
+    dec->row_buf = (ubyte *)malloc( dec->row_bytes );
+    if( dec->row_buf == NULL ) {
+        tga_converter_free( &dec->conv );
+        *error = TGA_ERR_NO_MEMORY;
+        return( 0 );
+    }
 
-            }
+    dec->rle_state.remaining = 0;
+    dec->rle_state.is_run = 0;
 
-        }
+    return( 1 );
 
-        break;
-    
+}
 
-    default:
 
-        TargaError = TGA_ERR_BAD_IMAGE_TYPE;
-        return( NULL );
+/* reads the next row of pixels and converts it into dst */
+static void tga_decode_row( tga_reader * reader, tga_decoder * dec, ubyte * dst, int32 dst_step ) {
 
+    if( dec->is_rle ) {
+        tga_read_row_rle( reader, &dec->rle_state, dec->row_buf, dec->width, dec->bytes_per_pix );
+    } else {
+        tga_read_row_unc( reader, dec->row_buf, dec->row_bytes, dec->bytes_per_pix );
     }
 
-    fclose( targafile );
-
-    *width  = img_spec_width;
-    *height = img_spec_height;
-
-    return( (void *)image_data );
+    tga_convert_row( &dec->conv, dec->row_buf, dst, dec->width, dst_step );
 
 }
 
 
+static void tga_decode_end( tga_decoder * dec ) {
 
+    free( dec->row_buf );
+    tga_converter_free( &dec->conv );
 
-int tga_write_raw( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
+}
 
-    FILE * tga;
 
-    uint32 i, j;
+/* decodes and converts a targa from a reader, into memory from alloc if it's given */
+static void * tga_decode( tga_reader * reader, int * width, int * height, unsigned int format, 
+                         tga_alloc_func alloc, void * ctx, int * error ) {
 
-    uint32 size = width * height;
+    tga_decoder dec;
 
-    float red, green, blue, alpha;
+    uint32 i;
 
-    char id[] = "written with libtarga";
-    ubyte idlen = 21;
-    ubyte zeroes[5] = { 0, 0, 0, 0, 0 };
-    uint32 pixbuf;
-    ubyte one = 1;
-    ubyte cmap_type = 0;
-    ubyte img_type  = 2;  // 2 - uncompressed truecolor  10 - RLE truecolor
-    uint16 xorigin  = 0;
-    uint16 yorigin  = 0;
-    ubyte  pixdepth = format * 8;  // bpp
-    ubyte img_desc;
-    
-    
-    switch( format ) {
+    ubyte * image_data;
+    size_t stride;
 
-    case TGA_TRUECOLOR_24:
-        img_desc = 0;
-        break;
+    ubyte * dst_row;
+    int32 dst_step;
 
-    case TGA_TRUECOLOR_32:
-        img_desc = 8;
-        break;
+    int top_down = (format & TGA_ORIGIN_UPPER) != 0;
 
-    default:
-        TargaError = TGA_ERR_BAD_FORMAT;
-        return( 0 );
-        break;
 
+    if( !tga_decode_begin( reader, &dec, format & ~TGA_ORIGIN_UPPER, error ) ) {
+        return( NULL );
     }
 
-    tga = fopen( file, "wb" );
+    /* compute how many bytes of storage we need for the image */
+    stride = 0;
+    if( alloc ) {
+        image_data = (ubyte *)alloc( dec.width, dec.height, &stride, ctx );
+    } else {
+        image_data = (ubyte *)malloc( (size_t)dec.width * dec.height * dec.format );
+    }
 
-    if( tga == NULL ) {
-        TargaError = TGA_ERR_OPEN_FAILS;
-        return( 0 );
+    if( stride == 0 ) {
+        stride = (size_t)dec.width * dec.format;
+    }
+
+    if( image_data == NULL ) {
+        tga_decode_end( &dec );
+        *error = TGA_ERR_NO_MEMORY;
+        return( NULL );
     }
 
-    // write id length
-    fwrite( &idlen, 1, 1, tga );
+    for( i = 0; i < dec.height; i++ ) {
 
-    // write colormap type
-    fwrite( &cmap_type, 1, 1, tga );
+        dst_row = tga_row_dest( image_data, dec.img_desc, 
+            tga_row_index( dec.img_desc, i, dec.height, top_down ), 
+            dec.width, dec.format, stride, &dst_step );
 
-    // write image type
-    fwrite( &img_type, 1, 1, tga );
+        tga_decode_row( reader, &dec, dst_row, dst_step );
 
-    // write cmap spec.
-    fwrite( &zeroes, 5, 1, tga );
+    }
 
-    // write image spec.
-    fwrite( &xorigin, 2, 1, tga );
-    fwrite( &yorigin, 2, 1, tga );
-    fwrite( &width, 2, 1, tga );
-    fwrite( &height, 2, 1, tga );
-    fwrite( &pixdepth, 1, 1, tga );
-    fwrite( &img_desc, 1, 1, tga );
+    tga_decode_end( &dec );
 
 
-    // write image id.
-    fwrite( &id, idlen, 1, tga );
+    *width  = dec.width;
+    *height = dec.height;
 
-    // color correction -- data is in RGB, need BGR.
-    for( i = 0; i < size; i++ ) {
+    return( (void *)image_data );
 
-        pixbuf = 0;
-        for( j = 0; j < format; j++ ) {
-            pixbuf += dat[i*format+j] << (8 * j);
-        }
+}
 
-        switch( format ) {
 
-        case TGA_TRUECOLOR_24:
 
-            pixbuf = ((pixbuf & 0xFF) << 16) + 
-                     (pixbuf & 0xFF00) + 
-                     ((pixbuf & 0xFF0000) >> 16);
 
-            pixbuf = htotl( pixbuf );
-            
-            fwrite( &pixbuf, 3, 1, tga );
+/* loads and converts a targa from disk */
+void * tga_load_r( const char * filename, 
+                  int * width, int * height, unsigned int format, int * error ) {
 
-            break;
+    return( tga_load_alloc_r( filename, width, height, format, NULL, NULL, error ) );
+
+}
 
-        case TGA_TRUECOLOR_32:
 
-            /* need to un-premultiply alpha.. */
+/* loads and converts a targa from disk into memory from alloc */
+void * tga_load_alloc_r( const char * filename, int * width, int * height, unsigned int format, 
+                        tga_alloc_func alloc, void * ctx, int * error ) {
 
-            red     = (pixbuf & 0xFF) / 255.0f;
-            green   = ((pixbuf & 0xFF00) >> 8) / 255.0f;
-            blue    = ((pixbuf & 0xFF0000) >> 16) / 255.0f;
-            alpha   = ((pixbuf & 0xFF000000) >> 24) / 255.0f;
+    FILE * targafile;
+    tga_reader reader;
+    void * image_data;
 
-            if( alpha > 0.0001 ) {
-                red /= alpha;
-                green /= alpha;
-                blue /= alpha;
-            }
+    /* open binary image file */
+    targafile = fopen( filename, "rb" );
+    if( targafile == NULL ) {
+        *error = TGA_ERR_OPEN_FAILS;
+        return( NULL );
+    }
 
-            /* clamp to 1.0f */
+    tga_reader_init( &reader, targafile );
 
-            red = red > 1.0f ? 255.0f : red * 255.0f;
-            green = green > 1.0f ? 255.0f : green * 255.0f;
-            blue = blue > 1.0f ? 255.0f : blue * 255.0f;
-            alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
+    image_data = tga_decode( &reader, width, height, format, alloc, ctx, error );
 
-            pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
-                
-            pixbuf = htotl( pixbuf );
-           
-            fwrite( &pixbuf, 4, 1, tga );
+    tga_reader_free( &reader );
+    fclose( targafile );
 
-            break;
+    return( image_data );
 
-        }
+}
 
-    }
 
-    fclose( tga );
+/* decodes and converts a targa held in memory */
+void * tga_decode_mem( const void * buf, size_t size, 
+                      int * width, int * height, unsigned int format, int * error ) {
 
-    return( 1 );
+    return( tga_decode_mem_alloc( buf, size, width, height, format, NULL, NULL, error ) );
 
 }
 
 
+/* decodes and converts a targa held in memory into memory from alloc */
+void * tga_decode_mem_alloc( const void * buf, size_t size, int * width, int * height, 
+                            unsigned int format, tga_alloc_func alloc, void * ctx, int * error ) {
 
+    tga_reader reader;
 
-int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
+    tga_reader_init_mem( &reader, (const ubyte *)buf, size );
+
+    return( tga_decode( &reader, width, height, format, alloc, ctx, error ) );
+
+}
 
-    FILE * tga;
 
-    uint32 i, j;
-    uint32 oc, nc;
+/* reads the header and id of a targa without touching the pixels */
+int tga_probe_r( const char * filename, tga_info * info, int * error ) {
 
-    enum RLE_STATE { INIT, NONE, RLP, RAWP };
+    FILE * targafile;
+    ubyte tga_hdr[HDR_LENGTH];
+    ubyte idlen;
+    ubyte image_type;
 
-    int state = INIT;
+    *error = TGA_ERR_NONE;
 
-    uint32 size = width * height;
+    targafile = fopen( filename, "rb" );
+    if( targafile == NULL ) {
+        *error = TGA_ERR_OPEN_FAILS;
+        return( 0 );
+    }
 
-    uint16 shortwidth = (uint16)width;
-    uint16 shortheight = (uint16)height;
+    if( fread( tga_hdr, 1, HDR_LENGTH, targafile ) != HDR_LENGTH ) {
+        fclose( targafile );
+        *error = TGA_ERR_BAD_HEADER;
+        return( 0 );
+    }
 
-    ubyte repcount;
+    idlen = tga_hdr[HDR_IDLEN];
+    if( fread( info->id, 1, idlen, targafile ) != idlen ) {
+        fclose( targafile );
+        *error = TGA_ERR_UNEXPECTED_EOF;
+        return( 0 );
+    }
+    info->id[idlen] = '\0';
 
-    float red, green, blue, alpha;
+    fclose( targafile );
 
-    int idx, row, column;
+    image_type = tga_hdr[HDR_IMAGE_TYPE];
 
-    // have to buffer a whole line for raw packets.
-    unsigned char * rawbuf = (unsigned char *)malloc( width * format );  
+    switch( image_type ) {
 
-    char id[] = "written with libtarga";
-    ubyte idlen = 21;
-    ubyte zeroes[5] = { 0, 0, 0, 0, 0 };
-    uint32 pixbuf;
-    ubyte one = 1;
-    ubyte cmap_type = 0;
-    ubyte img_type  = 10;  // 2 - uncompressed truecolor  10 - RLE truecolor
-    uint16 xorigin  = 0;
-    uint16 yorigin  = 0;
-    ubyte  pixdepth = format * 8;  // bpp
-    ubyte img_desc  = format == TGA_TRUECOLOR_32 ? 8 : 0;
-  
+    case TGA_IMG_NODATA:
+        *error = TGA_ERR_NODATA_IMAGE;
+        return( 0 );
 
-    switch( format ) {
-    case TGA_TRUECOLOR_24:
-    case TGA_TRUECOLOR_32:
+    case TGA_IMG_UNC_PALETTED:
+    case TGA_IMG_UNC_TRUECOLOR:
+    case TGA_IMG_UNC_GRAYSCALE:
+    case TGA_IMG_RLE_PALETTED:
+    case TGA_IMG_RLE_TRUECOLOR:
+    case TGA_IMG_RLE_GRAYSCALE:
         break;
 
     default:
-        TargaError = TGA_ERR_BAD_FORMAT;
+        *error = TGA_ERR_BAD_IMAGE_TYPE;
         return( 0 );
-    }
-
 
-    tga = fopen( file, "wb" );
+    }
 
-    if( tga == NULL ) {
-        TargaError = TGA_ERR_OPEN_FAILS;
+    /* byte order is important here. */
+    info->width           = (uint16)ttohs( *(uint16 *)(&tga_hdr[HDR_IMG_SPEC_WIDTH]) );
+    info->height          = (uint16)ttohs( *(uint16 *)(&tga_hdr[HDR_IMG_SPEC_HEIGHT]) );
+    info->pix_depth       = tga_hdr[HDR_IMG_SPEC_PIX_DEPTH];
+    info->cmap_entry_size = tga_hdr[HDR_CMAP_TYPE] ? tga_hdr[HDR_CMAP_ENTRY_SIZE] : 0;
+    info->alphabits       = tga_hdr[HDR_IMG_SPEC_IMG_DESC] & 0x0F;
+    info->paletted        = (image_type & 0x07) == TGA_IMG_UNC_PALETTED;
+    info->grayscale       = (image_type & 0x07) == TGA_IMG_UNC_GRAYSCALE;
+    info->rle             = (image_type & 0x08) != 0;
+    info->origin_upper    = (tga_hdr[HDR_IMG_SPEC_IMG_DESC] & 0x20) != 0;
+
+    if( info->width == 0 || info->height == 0 ) {
+        *error = TGA_ERR_BAD_DIMENSIONS;
         return( 0 );
     }
 
-    // write id length
-    fwrite( &idlen, 1, 1, tga );
-
-    // write colormap type
-    fwrite( &cmap_type, 1, 1, tga );
-
-    // write image type
-    fwrite( &img_type, 1, 1, tga );
+    return( 1 );
 
-    // write cmap spec.
-    fwrite( &zeroes, 5, 1, tga );
+}
 
-    // write image spec.
-    fwrite( &xorigin, 2, 1, tga );
-    fwrite( &yorigin, 2, 1, tga );
-    fwrite( &shortwidth, 2, 1, tga );
-    fwrite( &shortheight, 2, 1, tga );
-    fwrite( &pixdepth, 1, 1, tga );
-    fwrite( &img_desc, 1, 1, tga );
 
+/* maps an uncompressed truecolor targa for reading */
+void * tga_map_r( const char * filename, int * width, int * height, int * error ) {
 
-    // write image id.
-    fwrite( &id, idlen, 1, tga );
+    tga_map_view * view;
+    const ubyte * hdr;
+    uint32 pix_bytes;
+    size_t needed;
 
-    // initial color values -- just to shut up the compiler.
-    nc = 0;
+#ifdef _WIN32
+    LARGE_INTEGER file_size;
+#else
+    int fd;
+    struct stat st;
+#endif
 
-    // color correction -- data is in RGB, need BGR.
-    // also run-length-encoding.
-    for( i = 0; i < size; i++ ) {
+    *error = TGA_ERR_NONE;
 
-        idx = i * format;
+    view = (tga_map_view *)malloc( sizeof( tga_map_view ) );
+    if( view == NULL ) {
+        *error = TGA_ERR_CANNOT_MAP;
+        return( NULL );
+    }
 
-        row = i / width;
-        column = i % width;
+#ifdef _WIN32
+    view->file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, 
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+    if( view->file == INVALID_HANDLE_VALUE ) {
+        free( view );
+        *error = TGA_ERR_OPEN_FAILS;
+        return( NULL );
+    }
 
-        //printf( "row: %d, col: %d\n", row, column );
-        pixbuf = 0;
-        for( j = 0; j < format; j++ ) {
-            pixbuf += dat[idx+j] << (8 * j);
+    if( !GetFileSizeEx( view->file, &file_size ) || file_size.QuadPart < HDR_LENGTH ) {
+        CloseHandle( view->file );
+        free( view );
+        *error = TGA_ERR_BAD_HEADER;
+        return( NULL );
+    }
+    view->size = (size_t)file_size.QuadPart;
+
+    view->mapping = CreateFileMappingA( view->file, NULL, PAGE_READONLY, 0, 0, NULL );
+    view->base = view->mapping ? 
+        (const ubyte *)MapViewOfFile( view->mapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+    if( view->base == NULL ) {
+        if( view->mapping ) {
+            CloseHandle( view->mapping );
         }
+        CloseHandle( view->file );
+        free( view );
+        *error = TGA_ERR_CANNOT_MAP;
+        return( NULL );
+    }
+#else
+    fd = open( filename, O_RDONLY );
+    if( fd < 0 ) {
+        free( view );
+        *error = TGA_ERR_OPEN_FAILS;
+        return( NULL );
+    }
 
-        switch( format ) {
-
-        case TGA_TRUECOLOR_24:
+    if( fstat( fd, &st ) != 0 || st.st_size < HDR_LENGTH ) {
+        close( fd );
+        free( view );
+        *error = TGA_ERR_BAD_HEADER;
+        return( NULL );
+    }
+    view->size = (size_t)st.st_size;
+
+    view->base = (const ubyte *)mmap( NULL, view->size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    // the mapping holds its own reference to the file.
+    close( fd );
+    if( view->base == (const ubyte *)MAP_FAILED ) {
+        free( view );
+        *error = TGA_ERR_CANNOT_MAP;
+        return( NULL );
+    }
+#endif
 
-            pixbuf = ((pixbuf & 0xFF) << 16) + 
-                     (pixbuf & 0xFF00) + 
-                     ((pixbuf & 0xFF0000) >> 16);
+    hdr = view->base;
 
-            pixbuf = htotl( pixbuf );
-            break;
+    view->width     = (uint16)(hdr[HDR_IMG_SPEC_WIDTH] | (hdr[HDR_IMG_SPEC_WIDTH + 1] << 8));
+    view->height    = (uint16)(hdr[HDR_IMG_SPEC_HEIGHT] | (hdr[HDR_IMG_SPEC_HEIGHT + 1] << 8));
+    view->pix_depth = hdr[HDR_IMG_SPEC_PIX_DEPTH];
+    view->img_desc  = hdr[HDR_IMG_SPEC_IMG_DESC];
+    view->pixels    = hdr + HDR_LENGTH + hdr[HDR_IDLEN];
 
-        case TGA_TRUECOLOR_32:
+    pix_bytes = view->pix_depth >> 3;
+    needed = HDR_LENGTH + (size_t)hdr[HDR_IDLEN] + (size_t)view->width * view->height * pix_bytes;
 
-            /* need to un-premultiply alpha.. */
+    // only plain, complete, uncompressed 24/32-bit files are worth mapping; 
+    // anything else is left to tga_load.
+    if( hdr[HDR_IMAGE_TYPE] != TGA_IMG_UNC_TRUECOLOR || hdr[HDR_CMAP_TYPE] != 0 ||
+        (view->pix_depth != 24 && view->pix_depth != 32) ||
+        view->width == 0 || view->height == 0 || view->size < needed ) {
+        tga_unmap( view );
+        *error = TGA_ERR_CANNOT_MAP;
+        return( NULL );
+    }
 
-            red     = (pixbuf & 0xFF) / 255.0f;
-            green   = ((pixbuf & 0xFF00) >> 8) / 255.0f;
-            blue    = ((pixbuf & 0xFF0000) >> 16) / 255.0f;
-            alpha   = ((pixbuf & 0xFF000000) >> 24) / 255.0f;
+    *width  = view->width;
+    *height = view->height;
 
-            if( alpha > 0.0001 ) {
-                red /= alpha;
-                green /= alpha;
-                blue /= alpha;
-            }
+    return( (void *)view );
 
-            /* clamp to 1.0f */
+}
 
-            red = red > 1.0f ? 255.0f : red * 255.0f;
-            green = green > 1.0f ? 255.0f : green * 255.0f;
-            blue = blue > 1.0f ? 255.0f : blue * 255.0f;
-            alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
 
-            pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
-                
-            pixbuf = htotl( pixbuf );
-            break;
+/* converts the pixels of a mapped targa into memory */
+int tga_map_read_r( void * map, unsigned char * dat, unsigned int format, int * error ) {
 
-        }
+    return( tga_map_read_stride_r( map, dat, 0, format, error ) );
 
+}
 
-        oc = nc;
 
-        nc = pixbuf;
+int tga_map_read_stride_r( void * map, unsigned char * dat, size_t stride, unsigned int format, 
+                           int * error ) {
 
+    tga_map_view * view = (tga_map_view *)map;
+    tga_converter conv;
+    uint32 pix_bytes;
+    uint32 row_bytes;
+    uint32 i;
+    ubyte * dst_row;
+    int32 dst_step;
+    int top_down = (format & TGA_ORIGIN_UPPER) != 0;
 
-        switch( state ) {
+    *error = TGA_ERR_NONE;
+    format &= ~TGA_ORIGIN_UPPER;
 
-        case INIT:
-            // this is just used to make sure we have 2 pixel values to consider.
-            state = NONE;
-            break;
+    switch( format ) {
 
+    case TGA_TRUECOLOR_24:
+    case TGA_TRUECOLOR_32:
+        break;
 
-        case NONE:
+    default:
+        *error = TGA_ERR_BAD_FORMAT;
+        return( 0 );
 
-            if( column == 0 ) {
-                // write a 1 pixel raw packet for the old pixel, then go thru again.
-                repcount = 0;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-                break;
-            }
+    }
 
-            if( nc == oc ) {
-                repcount = 0;
-                state = RLP;
-            } else {
-                repcount = 0;
-                state = RAWP;
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
-                }
-            }
-            break;
+    pix_bytes = view->pix_depth >> 3;
+    row_bytes = view->width * pix_bytes;
+
+    if( stride == 0 ) {
+        stride = (size_t)view->width * format;
+    }
+
+    if( !tga_converter_init( &conv, (ubyte)pix_bytes, view->pix_depth, view->img_desc & 0x0F, NULL, 0, 0, 0, format ) ) {
+        tga_converter_free( &conv );
+        *error = TGA_ERR_NO_MEMORY;
+        return( 0 );
+    }
+
+    // one pass, straight from the page cache into the caller's buffer.
+    for( i = 0; i < view->height; i++ ) {
+
+        dst_row = tga_row_dest( dat, view->img_desc, 
+            tga_row_index( view->img_desc, i, view->height, top_down ), 
+            view->width, format, stride, &dst_step );
+
+        tga_convert_row( &conv, view->pixels + (size_t)i * row_bytes, dst_row, view->width, dst_step );
+
+    }
+
+    tga_converter_free( &conv );
+
+    return( 1 );
+
+}
+
+
+/* releases a mapping made by tga_map */
+void tga_unmap( void * map ) {
+
+    tga_map_view * view = (tga_map_view *)map;
+
+    if( view == NULL ) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile( (LPCVOID)view->base );
+    CloseHandle( view->mapping );
+    CloseHandle( view->file );
+#else
+    munmap( (void *)view->base, view->size );
+#endif
+
+    free( view );
+
+}
+
+
+
+
+/* writes the header and id of a truecolor targa.  rows follow top to bottom 
+   if top_down is set, else bottom to top. */
+static int tga_put_header( tga_writer * writer, int width, int height, unsigned int format, 
+                          int rle, int top_down, int * error ) {
+
+    char id[] = "written with libtarga";
+    ubyte idlen = 21;
+    ubyte tga_hdr[HDR_LENGTH];
+    ubyte img_desc;
+
+    switch( format ) {
+
+    case TGA_TRUECOLOR_24:
+        img_desc = 0;
+        break;
+
+    case TGA_TRUECOLOR_32:
+        img_desc = 8;
+        break;
+
+    default:
+        *error = TGA_ERR_BAD_FORMAT;
+        return( 0 );
+
+    }
+
+    if( width < 0 || width > 0xFFFF || height < 0 || height > 0xFFFF ) {
+        *error = TGA_ERR_TOO_BIG;
+        return( 0 );
+    }
+
+    if( top_down ) {
+        img_desc |= TGA_UPPER_LEFT << 4;
+    }
+
+    // header -- no colormap, little-endian fields.
+    memset( tga_hdr, 0, HDR_LENGTH );
+    tga_hdr[HDR_IDLEN]                  = idlen;
+    tga_hdr[HDR_IMAGE_TYPE]             = rle ? TGA_IMG_RLE_TRUECOLOR : TGA_IMG_UNC_TRUECOLOR;
+    tga_hdr[HDR_IMG_SPEC_WIDTH]         = (ubyte)(width & 0xFF);
+    tga_hdr[HDR_IMG_SPEC_WIDTH + 1]     = (ubyte)((width >> 8) & 0xFF);
+    tga_hdr[HDR_IMG_SPEC_HEIGHT]        = (ubyte)(height & 0xFF);
+    tga_hdr[HDR_IMG_SPEC_HEIGHT + 1]    = (ubyte)((height >> 8) & 0xFF);
+    tga_hdr[HDR_IMG_SPEC_PIX_DEPTH]     = (ubyte)(format * 8);
+    tga_hdr[HDR_IMG_SPEC_IMG_DESC]      = img_desc;
+
+    tga_writer_put( writer, tga_hdr, HDR_LENGTH );
+
+    // write image id.
+    tga_writer_put( writer, id, idlen );
+
+    return( 1 );
+
+}
+
+
+/* writes one row of pixels.  row_buf holds a row of file pixels; packet_buf, 
+   twice that, is only needed for run-length encoding. */
+static void tga_put_row( tga_writer * writer, const ubyte * src, uint32 width, uint32 format, 
+                        int rle, ubyte * row_buf, ubyte * packet_buf ) {
+
+    uint32 packet_bytes;
+
+    // color correction -- data is in RGB, need BGR.
+    tga_encode_row( src, row_buf, width, format );
+
+    if( rle ) {
+        packet_bytes = tga_rle_encode_row( row_buf, packet_buf, width, format );
+        tga_writer_put( writer, packet_buf, packet_bytes );
+    } else {
+        tga_writer_put( writer, row_buf, width * format );
+    }
+
+}
+
+
+/* encodes an image through a writer.  rows of dat are stride bytes apart, 0 meaning packed. */
+static int tga_encode( tga_writer * writer, int width, int height, unsigned char * dat, 
+                      size_t stride, unsigned int format, int rle, int * error ) {
+
+    int top_down = (format & TGA_ORIGIN_UPPER) != 0;
+
+
+    *error = TGA_ERR_NONE;
+    format &= ~TGA_ORIGIN_UPPER;
+
+    // the file is always written bottom row first, a row at a time.
+    if( !tga_put_header( writer, width, height, format, rle, 0, error ) ) {
+        return( 0 );
+    }
+
+    if( stride == 0 ) {
+        stride = (size_t)width * format;
+    }
+
+    if( rle && (size_t)width * height >= TGA_RLE_PARALLEL_PIXELS ) {
+        tga_encode_rle_parallel( writer, dat, width, height, stride, format, top_down );
+    } else {
+        tga_encode_rows( writer, dat, width, height, stride, 0, height, format, rle, top_down );
+    }
+
+    if( writer->failed ) {
+        *error = writer->failed;
+        return( 0 );
+    }
+
+    return( 1 );
+
+}
+
+
+/* encodes an image to a file */
+static int tga_write_file( const char * file, int width, int height, unsigned char * dat, 
+                          size_t stride, unsigned int format, int rle, int * error ) {
+
+    tga_writer writer;
+    int result;
+
+    writer.buf = NULL;
+    writer.len = 0;
+    writer.cap = 0;
+    writer.failed = TGA_ERR_NONE;
+
+    writer.file = fopen( file, "wb" );
+
+    if( writer.file == NULL ) {
+        *error = TGA_ERR_OPEN_FAILS;
+        return( 0 );
+    }
+
+    result = tga_encode( &writer, width, height, dat, stride, format, rle, error );
+
+    // close the file, and don't leave half of one behind.
+    if( fclose( writer.file ) != 0 && result ) {
+        *error = TGA_ERR_WRITE_FAILS;
+        result = 0;
+    }
+
+    if( !result ) {
+        remove( file );
+    }
+
+    return( result );
+
+}
+
+
+int tga_write_raw_r( const char * file, int width, int height, unsigned char * dat, 
+                     unsigned int format, int * error ) {
+
+    return( tga_write_file( file, width, height, dat, 0, format, 0, error ) );
+
+}
+
+
+int tga_write_rle_r( const char * file, int width, int height, unsigned char * dat, 
+                     unsigned int format, int * error ) {
+
+    return( tga_write_file( file, width, height, dat, 0, format, 1, error ) );
+
+}
+
+
+int tga_write_stride_r( const char * file, int width, int height, unsigned char * dat, 
+                        size_t stride, unsigned int format, int rle, int * error ) {
+
+    return( tga_write_file( file, width, height, dat, stride, format, rle, error ) );
+
+}
+
+
+/* encodes an image into a newly allocated buffer */
+void * tga_encode_mem( int width, int height, unsigned char * dat, unsigned int format, 
+                      int rle, size_t * size, int * error ) {
+
+    return( tga_encode_mem_stride( width, height, dat, 0, format, rle, size, error ) );
+
+}
+
+
+void * tga_encode_mem_stride( int width, int height, unsigned char * dat, size_t stride, 
+                              unsigned int format, int rle, size_t * size, int * error ) {
+
+    tga_writer writer;
+
+    // room for a whole uncompressed file up front; run-length encoded 
+    // output usually fits in that too.
+    writer.file = NULL;
+    writer.len = 0;
+    writer.cap = HDR_LENGTH + 21 + (size_t)width * height * (format & ~TGA_ORIGIN_UPPER);
+    writer.buf = (ubyte *)malloc( writer.cap );
+    writer.failed = writer.buf == NULL ? TGA_ERR_NO_MEMORY : TGA_ERR_NONE;
+
+    if( !tga_encode( &writer, width, height, dat, stride, format, rle, error ) ) {
+        free( writer.buf );
+        return( NULL );
+    }
+
+    *size = writer.len;
+
+    return( (void *)writer.buf );
+
+}
+
+
+
+
+/* opens a targa to be read a band of rows at a time */
+void * tga_band_open_r( const char * filename, 
+                       int * width, int * height, unsigned int format, int * error ) {
+
+    tga_band_reader * bands;
+    FILE * targafile;
+    uint32 i;
+
+    targafile = fopen( filename, "rb" );
+    if( targafile == NULL ) {
+        *error = TGA_ERR_OPEN_FAILS;
+        return( NULL );
+    }
+
+    bands = (tga_band_reader *)malloc( sizeof( tga_band_reader ) );
+    if( bands == NULL ) {
+        fclose( targafile );
+        *error = TGA_ERR_NO_MEMORY;
+        return( NULL );
+    }
+    bands->file = targafile;
+    tga_reader_init( &bands->reader, targafile );
+
+    if( !tga_decode_begin( &bands->reader, &bands->dec, format & ~TGA_ORIGIN_UPPER, error ) ) {
+        tga_reader_free( &bands->reader );
+        fclose( targafile );
+        free( bands );
+        return( NULL );
+    }
+
+    bands->top_down = (format & TGA_ORIGIN_UPPER) != 0;
+    bands->next = 0;
+    bands->reversed = tga_row_index( bands->dec.img_desc, 0, bands->dec.height, bands->top_down ) != 0;
+    bands->data_start = tga_reader_tell( &bands->reader );
+    bands->marks = NULL;
+
+    // bands are handed out in memory order.  when the file runs the other way 
+    // each band is read back from its last file row, which means seeking -- 
+    // easy for raw rows, but run-length packets don't line up with rows, so 
+    // note where every row starts in one pass through the file.
+    if( bands->reversed && bands->dec.is_rle ) {
+
+        bands->marks = (tga_row_mark *)malloc( bands->dec.height * sizeof( tga_row_mark ) );
+        if( bands->marks == NULL ) {
+            tga_band_close( bands );
+            *error = TGA_ERR_NO_MEMORY;
+            return( NULL );
+        }
+
+        for( i = 0; i < bands->dec.height; i++ ) {
+            bands->marks[i].offset = tga_reader_tell( &bands->reader );
+            bands->marks[i].state = bands->dec.rle_state;
+            tga_read_row_rle( &bands->reader, &bands->dec.rle_state, bands->dec.row_buf, 
+                bands->dec.width, bands->dec.bytes_per_pix );
+        }
+
+    }
+
+    *width  = bands->dec.width;
+    *height = bands->dec.height;
+
+    return( (void *)bands );
+
+}
+
+
+/* reads the next band of up to rows rows, returning how many there were */
+int tga_band_read_r( void * band_reader, unsigned char * dat, int rows, int * error ) {
+
+    return( tga_band_read_stride_r( band_reader, dat, 0, rows, error ) );
+
+}
+
+
+int tga_band_read_stride_r( void * band_reader, unsigned char * dat, size_t stride, int rows, 
+                            int * error ) {
+
+    tga_band_reader * bands = (tga_band_reader *)band_reader;
+    tga_decoder * dec = &bands->dec;
+    uint32 n;
+    uint32 i;
+    uint32 row;
+    ubyte * dst_row;
+    int32 dst_step;
+    tga_off offset;
+
+    *error = TGA_ERR_NONE;
+
+    n = dec->height - bands->next;
+    if( rows <= 0 ) {
+        n = 0;
+    } else if( (uint32)rows < n ) {
+        n = rows;
+    }
+
+    if( n == 0 ) {
+        return( 0 );
+    }
+
+    if( stride == 0 ) {
+        stride = (size_t)dec->width * dec->format;
+    }
+
+    if( bands->reversed ) {
+
+        // the band's rows lie together in the file, starting from this one.
+        row = dec->height - bands->next - n;
+
+        if( dec->is_rle ) {
+            offset = bands->marks[row].offset;
+            dec->rle_state = bands->marks[row].state;
+        } else {
+            offset = bands->data_start + (tga_off)row * dec->row_bytes;
+        }
+
+        if( !tga_reader_seek( &bands->reader, offset ) ) {
+            *error = TGA_ERR_READ_FAILS;
+            return( 0 );
+        }
+
+    } else {
+        row = bands->next;
+    }
+
+    for( i = 0; i < n; i++, row++ ) {
+
+        dst_row = tga_row_dest( dat, dec->img_desc, 
+            tga_row_index( dec->img_desc, row, dec->height, bands->top_down ) - bands->next, 
+            dec->width, dec->format, stride, &dst_step );
+
+        tga_decode_row( &bands->reader, dec, dst_row, dst_step );
+
+    }
+
+    bands->next += n;
+
+    return( n );
+
+}
+
+
+void tga_band_close( void * band_reader ) {
+
+    tga_band_reader * bands = (tga_band_reader *)band_reader;
+
+    if( bands == NULL ) {
+        return;
+    }
+
+    tga_decode_end( &bands->dec );
+    tga_reader_free( &bands->reader );
+    fclose( bands->file );
+    free( bands->marks );
+    free( bands );
+
+}
+
+
+/* creates a targa to be written a band of rows at a time */
+void * tga_band_create_r( const char * file, int width, int height, unsigned int format, 
+                         int rle, int * error ) {
+
+    tga_band_writer * bands;
+    int top_down = (format & TGA_ORIGIN_UPPER) != 0;
+
+    *error = TGA_ERR_NONE;
+    format &= ~TGA_ORIGIN_UPPER;
+
+    if( format != TGA_TRUECOLOR_24 && format != TGA_TRUECOLOR_32 ) {
+        *error = TGA_ERR_BAD_FORMAT;
+        return( NULL );
+    }
+
+    bands = (tga_band_writer *)malloc( sizeof( tga_band_writer ) );
+    if( bands == NULL ) {
+        *error = TGA_ERR_NO_MEMORY;
+        return( NULL );
+    }
+
+    bands->writer.buf = NULL;
+    bands->writer.len = 0;
+    bands->writer.cap = 0;
+    bands->writer.failed = TGA_ERR_NONE;
+
+    bands->writer.file = fopen( file, "wb" );
+
+    if( bands->writer.file == NULL ) {
+        free( bands );
+        *error = TGA_ERR_OPEN_FAILS;
+        return( NULL );
+    }
+
+    // rows go into the file in the order they're handed to us, and the 
+    // header says which way that is.
+    if( !tga_put_header( &bands->writer, width, height, format, rle, top_down, error ) ) {
+        fclose( bands->writer.file );
+        free( bands );
+        return( NULL );
+    }
+
+    bands->width = width;
+    bands->height = height;
+    bands->format = format;
+    bands->rle = rle;
+    bands->next = 0;
+    bands->row_buf = (ubyte *)malloc( (size_t)width * format );
+    bands->packet_buf = rle ? (ubyte *)malloc( 2 * (size_t)width * format ) : NULL;
+
+    if( bands->row_buf == NULL || (rle && bands->packet_buf == NULL) ) {
+        fclose( bands->writer.file );
+        free( bands->row_buf );
+        free( bands->packet_buf );
+        free( bands );
+        *error = TGA_ERR_NO_MEMORY;
+        return( NULL );
+    }
+
+    return( (void *)bands );
+
+}
+
+
+/* writes the next band of rows, returning how many were taken */
+int tga_band_write_r( void * band_writer, unsigned char * dat, int rows, int * error ) {
+
+    return( tga_band_write_stride_r( band_writer, dat, 0, rows, error ) );
+
+}
+
+
+int tga_band_write_stride_r( void * band_writer, unsigned char * dat, size_t stride, int rows, 
+                             int * error ) {
+
+    tga_band_writer * bands = (tga_band_writer *)band_writer;
+    uint32 n;
+    uint32 i;
+
+    *error = TGA_ERR_NONE;
+
+    // anything past the bottom of the image is dropped.
+    n = bands->height - bands->next;
+    if( rows <= 0 ) {
+        n = 0;
+    } else if( (uint32)rows < n ) {
+        n = rows;
+    }
+
+    if( stride == 0 ) {
+        stride = (size_t)bands->width * bands->format;
+    }
+
+    for( i = 0; i < n; i++ ) {
+        tga_put_row( &bands->writer, dat + (size_t)i * stride, bands->width, 
+            bands->format, bands->rle, bands->row_buf, bands->packet_buf );
+    }
+
+    if( bands->writer.failed ) {
+        *error = bands->writer.failed;
+        return( 0 );
+    }
+
+    bands->next += n;
+
+    return( n );
+
+}
+
+
+/* completes the file and closes it.  rows never written are left empty. */
+int tga_band_finish_r( void * band_writer, int * error ) {
+
+    tga_band_writer * bands = (tga_band_writer *)band_writer;
+    ubyte * empty;
+    int result = 1;
+
+    *error = TGA_ERR_NONE;
+
+    if( bands->next < bands->height ) {
+
+        *error = TGA_ERR_MISSING_ROWS;
+        result = 0;
+
+        // pad it out so that the file still reads back.
+        empty = (ubyte *)calloc( bands->width, bands->format );
+        if( empty == NULL ) {
+            bands->writer.failed = TGA_ERR_NO_MEMORY;
+        }
+        while( bands->next < bands->height && !bands->writer.failed ) {
+            tga_put_row( &bands->writer, empty, bands->width, bands->format, bands->rle, 
+                bands->row_buf, bands->packet_buf );
+            bands->next++;
+        }
+        free( empty );
+
+    }
+
+    if( bands->writer.failed ) {
+        *error = bands->writer.failed;
+        result = 0;
+    }
+
+    if( fclose( bands->writer.file ) != 0 && result ) {
+        *error = TGA_ERR_WRITE_FAILS;
+        result = 0;
+    }
+
+    free( bands->row_buf );
+    free( bands->packet_buf );
+    free( bands );
+
+    return( result );
+
+}
+
+
+
+
+/*
+   The non-reentrant calls below report through the shared last error.
+*/
+
+void * tga_create( int width, int height, unsigned int format ) {
+
+    int error;
+    void * result = tga_create_r( width, height, format, &error );
+
+    if( result == NULL ) {
+        TargaError = error;
+    }
+
+    return( result );
+
+}
+
+
+void * tga_load( const char * filename, int * width, int * height, unsigned int format ) {
+
+    int error;
+    void * result = tga_load_r( filename, width, height, format, &error );
+
+    if( result == NULL ) {
+        TargaError = error;
+    }
+
+    return( result );
+
+}
+
+
+int tga_probe( const char * filename, tga_info * info ) {
+
+    int error;
+    int result = tga_probe_r( filename, info, &error );
+
+    if( !result ) {
+        TargaError = error;
+    }
+
+    return( result );
+
+}
+
+
+void * tga_map( const char * filename, int * width, int * height ) {
+
+    int error;
+    void * result = tga_map_r( filename, width, height, &error );
+
+    if( result == NULL ) {
+        TargaError = error;
+    }
+
+    return( result );
+
+}
+
+
+int tga_map_read( void * map, unsigned char * dat, unsigned int format ) {
+
+    int error;
+    int result = tga_map_read_r( map, dat, format, &error );
+
+    if( !result ) {
+        TargaError = error;
+    }
+
+    return( result );
+
+}
+
+
+int tga_write_raw( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
+
+    int error;
+    int result = tga_write_raw_r( file, width, height, dat, format, &error );
+
+    if( !result ) {
+        TargaError = error;
+    }
+
+    return( result );
+
+}
+
+
+int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
+
+    int error;
+    int result = tga_write_rle_r( file, width, height, dat, format, &error );
+
+    if( !result ) {
+        TargaError = error;
+    }
+
+    return( result );
+
+}
+
+
+
+/*************************************************************************************************/
+
+
+
+
+
+static void tga_reader_init( tga_reader * reader, FILE * file ) {
+
+    reader->file  = file;
+    reader->owned = (ubyte *)malloc( TGA_READ_CHUNK );
+    reader->buf   = reader->owned;
+    reader->len   = 0;
+    reader->pos   = 0;
+
+}
+
+
+
+
+static void tga_reader_init_mem( tga_reader * reader, const ubyte * buf, size_t size ) {
+
+    reader->file  = NULL;
+    reader->owned = NULL;
+    reader->buf   = buf;
+    reader->len   = size;
+    reader->pos   = 0;
+
+}
+
+
+
+
+static uint32 tga_reader_read( tga_reader * reader, ubyte * dst, uint32 count ) {
+
+    // copy up to count bytes out, refilling the buffer as needed.
+    // returns the number of bytes actually delivered.
+
+    uint32 done = 0;
+    size_t avail;
+
+    while( done < count ) {
+
+        avail = reader->len - reader->pos;
+
+        if( avail == 0 ) {
+
+            if( reader->file == NULL ) {
+                break;
+            }
+
+            // big requests skip the buffer and go straight to the destination.
+            if( count - done >= TGA_READ_CHUNK ) {
+                done += (uint32)fread( dst + done, 1, count - done, reader->file );
+                break;
+            }
+
+            reader->pos = 0;
+            reader->len = fread( reader->owned, 1, TGA_READ_CHUNK, reader->file );
+            if( reader->len == 0 ) {
+                break;
+            }
+            continue;
+        }
+
+        if( avail > count - done ) {
+            avail = count - done;
+        }
+
+        memcpy( dst + done, reader->buf + reader->pos, avail );
+        reader->pos += avail;
+        done += (uint32)avail;
+
+    }
+
+    return( done );
+
+}
+
+
+
+
+static int tga_reader_skip( tga_reader * reader, size_t count ) {
+
+    // move ahead count bytes.  returns 0 if that couldn't be done.
+
+    size_t avail = reader->len - reader->pos;
+
+    if( count <= avail ) {
+        reader->pos += count;
+        return( 1 );
+    }
+
+    reader->pos = reader->len;
+
+    if( reader->file == NULL ) {
+        return( 0 );
+    }
+
+    return( tga_fseek( reader->file, (tga_off)(count - avail), SEEK_CUR ) == 0 );
+
+}
+
+
+
+
+static tga_off tga_reader_tell( tga_reader * reader ) {
+
+    // offset of the next unread byte.
+
+    if( reader->file == NULL ) {
+        return( (tga_off)reader->pos );
+    }
+
+    return( tga_ftell( reader->file ) - (tga_off)(reader->len - reader->pos) );
+
+}
+
+
+
+
+static int tga_reader_seek( tga_reader * reader, tga_off offset ) {
+
+    // move to the given offset.  returns 0 if that couldn't be done.
+
+    tga_off buf_start;
+
+    if( reader->file == NULL ) {
+        if( offset < 0 || (size_t)offset > reader->len ) {
+            return( 0 );
+        }
+        reader->pos = (size_t)offset;
+        return( 1 );
+    }
+
+    // stay in the buffer if we can.
+    buf_start = tga_ftell( reader->file ) - (tga_off)reader->len;
+    if( offset >= buf_start && offset < buf_start + (tga_off)reader->len ) {
+        reader->pos = (size_t)(offset - buf_start);
+        return( 1 );
+    }
+
+    reader->len = 0;
+    reader->pos = 0;
+
+    return( tga_fseek( reader->file, offset, SEEK_SET ) == 0 );
+
+}
+
+
+
+
+static void tga_reader_free( tga_reader * reader ) {
+
+    free( reader->owned );
+    reader->owned = NULL;
+    reader->buf = NULL;
+
+}
+
+
+
+
+static void tga_writer_put( tga_writer * writer, const void * src, size_t count ) {
+
+    size_t cap;
+    ubyte * grown;
+
+    if( writer->failed ) {
+        return;
+    }
+
+    if( writer->file != NULL ) {
+        if( fwrite( src, 1, count, writer->file ) != count ) {
+            writer->failed = TGA_ERR_WRITE_FAILS;
+        }
+        return;
+    }
+
+    if( writer->len + count > writer->cap ) {
+        cap = writer->cap * 2;
+        if( cap < writer->len + count ) {
+            cap = writer->len + count;
+        }
+        grown = (ubyte *)realloc( writer->buf, cap );
+        if( grown == NULL ) {
+            writer->failed = TGA_ERR_NO_MEMORY;
+            return;
+        }
+        writer->buf = grown;
+        writer->cap = cap;
+    }
+
+    memcpy( writer->buf + writer->len, src, count );
+    writer->len += count;
+
+}
+
+
+
+static void tga_encode_rows( tga_writer * writer, const ubyte * dat, uint32 width, uint32 height, 
+                            size_t stride, uint32 first, uint32 rows, uint32 format, int rle, 
+                            int top_down ) {
+
+    // encode file rows first on; the file is bottom row first.
+
+    uint32 i;
+    const ubyte * src;
+    ubyte * row_buf;
+    ubyte * packet_buf = NULL;
+
+    // a run-length encoded row never packs to more than twice its raw size.
+    row_buf = (ubyte *)malloc( (size_t)width * format );
+    if( rle ) {
+        packet_buf = (ubyte *)malloc( 2 * (size_t)width * format );
+    }
+
+    if( row_buf == NULL || (rle && packet_buf == NULL) ) {
+        if( !writer->failed ) {
+            writer->failed = TGA_ERR_NO_MEMORY;
+        }
+        free( row_buf );
+        free( packet_buf );
+        return;
+    }
+
+    for( i = first; i < first + rows && !writer->failed; i++ ) {
+
+        src = dat + (size_t)(top_down ? height - 1 - i : i) * stride;
+
+        tga_put_row( writer, src, width, format, rle, row_buf, packet_buf );
+
+    }
+
+    free( row_buf );
+    free( packet_buf );
+
+}
+
+
+
+
+static void tga_encode_rle_parallel( tga_writer * writer, const ubyte * dat, uint32 width, 
+                                    uint32 height, size_t stride, uint32 format, int top_down ) {
+
+    // run-length encode bands of rows into memory on their own threads, 
+    // then put the bands out in order.  the calling thread takes the first 
+    // band itself, and any band whose thread won't start.
+
+    tga_rle_job * jobs;
+    uint32 count;
+    uint32 i;
+    int * started;
+
+#ifdef _WIN32
+    HANDLE * threads;
+#else
+    pthread_t * threads;
+#endif
+
+    count = tga_cpu_count();
+    if( count > height / TGA_RLE_MIN_ROWS ) {
+        count = height / TGA_RLE_MIN_ROWS;
+    }
+    if( count > TGA_RLE_MAX_THREADS ) {
+        count = TGA_RLE_MAX_THREADS;
+    }
+
+    if( count < 2 ) {
+        tga_encode_rows( writer, dat, width, height, stride, 0, height, format, 1, top_down );
+        return;
+    }
+
+    jobs = (tga_rle_job *)malloc( count * sizeof( tga_rle_job ) );
+    started = (int *)calloc( count, sizeof( int ) );
+#ifdef _WIN32
+    threads = (HANDLE *)malloc( count * sizeof( HANDLE ) );
+#else
+    threads = (pthread_t *)malloc( count * sizeof( pthread_t ) );
+#endif
+
+    // without room to keep track of the bands, do it all here.
+    if( jobs == NULL || started == NULL || threads == NULL ) {
+        free( threads );
+        free( started );
+        free( jobs );
+        tga_encode_rows( writer, dat, width, height, stride, 0, height, format, 1, top_down );
+        return;
+    }
+
+    for( i = 0; i < count; i++ ) {
+
+        jobs[i].dat      = dat;
+        jobs[i].width    = width;
+        jobs[i].height   = height;
+        jobs[i].stride   = stride;
+        jobs[i].first    = (uint32)((size_t)height * i / count);
+        jobs[i].rows     = (uint32)((size_t)height * (i + 1) / count) - jobs[i].first;
+        jobs[i].format   = format;
+        jobs[i].top_down = top_down;
+
+        // most images pack well below their raw size; the buffer grows if not.
+        // a band there's no room for is encoded straight out when its turn comes.
+        jobs[i].out.file   = NULL;
+        jobs[i].out.len    = 0;
+        jobs[i].out.cap    = (size_t)jobs[i].rows * width * format;
+        jobs[i].out.buf    = (ubyte *)malloc( jobs[i].out.cap );
+        jobs[i].out.failed = TGA_ERR_NONE;
+
+        if( i > 0 && jobs[i].out.buf != NULL ) {
+#ifdef _WIN32
+            threads[i] = CreateThread( NULL, 0, tga_rle_thread, &jobs[i], 0, NULL );
+            started[i] = threads[i] != NULL;
+#else
+            started[i] = pthread_create( &threads[i], NULL, tga_rle_thread, &jobs[i] ) == 0;
+#endif
+        }
+
+    }
+
+    for( i = 0; i < count; i++ ) {
+
+        if( jobs[i].out.buf == NULL ) {
+            tga_encode_rows( writer, dat, width, height, stride, jobs[i].first, jobs[i].rows, 
+                format, 1, top_down );
+            continue;
+        }
+
+        if( started[i] ) {
+#ifdef _WIN32
+            WaitForSingleObject( threads[i], INFINITE );
+            CloseHandle( threads[i] );
+#else
+            pthread_join( threads[i], NULL );
+#endif
+        } else {
+            tga_rle_thread( &jobs[i] );
+        }
+
+        if( jobs[i].out.failed && !writer->failed ) {
+            writer->failed = jobs[i].out.failed;
+        }
+        tga_writer_put( writer, jobs[i].out.buf, jobs[i].out.len );
+        free( jobs[i].out.buf );
+
+    }
+
+    free( threads );
+    free( started );
+    free( jobs );
+
+}
+
+
+
+
+#ifdef _WIN32
+static DWORD WINAPI tga_rle_thread( LPVOID arg ) {
+#else
+static void * tga_rle_thread( void * arg ) {
+#endif
+
+    tga_rle_job * job = (tga_rle_job *)arg;
+
+    tga_encode_rows( &job->out, job->dat, job->width, job->height, job->stride, job->first, 
+        job->rows, job->format, 1, job->top_down );
+
+#ifdef _WIN32
+    return( 0 );
+#else
+    return( NULL );
+#endif
+
+}
+
+
+
+
+static int tga_cpu_count( void ) {
+
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo( &info );
+    return( (int)info.dwNumberOfProcessors );
+#else
+    long count = sysconf( _SC_NPROCESSORS_ONLN );
+    return( count > 0 ? (int)count : 1 );
+#endif
+
+}
+
+
+
+
+static void tga_read_row_unc( tga_reader * reader, ubyte * row, uint32 row_bytes, ubyte bytes_per_pix ) {
+
+    uint32 got = tga_reader_read( reader, row, row_bytes );
+
+    if( got < row_bytes ) {
+        // short file -- a partially read pixel counts as missing, missing pixels are zero.
+        got -= got % bytes_per_pix;
+        memset( row + got, 0, row_bytes - got );
+    }
+
+}
+
+
+
+
+static void tga_read_row_rle( tga_reader * reader, tga_rle_state * state, ubyte * row, 
+                             uint32 w, ubyte bytes_per_pix ) {
+
+    uint32 x = 0;
+    uint32 n;
+    uint32 got;
+    ubyte packet_header;
+
+    while( x < w ) {
+
+        if( state->remaining == 0 ) {
+
+            if( tga_reader_read( reader, &packet_header, 1 ) < 1 ) {
+                // well, just let them fill the rest with null pixels then...
+                memset( row + x * bytes_per_pix, 0, (w - x) * bytes_per_pix );
+                return;
+            }
+
+            state->is_run    = packet_header & 0x80;
+            state->remaining = (packet_header & 0x7F) + 1;
+
+            if( state->is_run &&
+                tga_reader_read( reader, state->pixel, bytes_per_pix ) < bytes_per_pix ) {
+                memset( state->pixel, 0, sizeof( state->pixel ) );
+            }
+        }
+
+        n = state->remaining < w - x ? state->remaining : w - x;
+
+        if( state->is_run ) {
+
+            /* run length packet */
+            for( got = 0; got < n; got++ ) {
+                memcpy( row + (x + got) * bytes_per_pix, state->pixel, bytes_per_pix );
+            }
+
+        } else {
+
+            /* raw packet */
+            got = tga_reader_read( reader, row + x * bytes_per_pix, n * bytes_per_pix );
+            if( got < n * bytes_per_pix ) {
+                got -= got % bytes_per_pix;
+                memset( row + x * bytes_per_pix + got, 0, (w - x) * bytes_per_pix - got );
+                state->remaining = 0;
+                return;
+            }
+
+        }
+
+        x += n;
+        state->remaining -= n;
+
+    }
+
+}
+
+
+
+
+static uint32 tga_row_index( ubyte img_desc, uint32 row, uint32 h, int top_down ) {
+
+    // find which row in memory the given file row lands on regarding how 
+    // the header says the data is ordered.
+
+    uint32 y;
+
+    switch( (img_desc & 0x30) >> 4 ) {
+
+    case TGA_UPPER_LEFT:
+    case TGA_UPPER_RIGHT:
+        y = h - 1 - row;
+        break;
+
+    case TGA_LOWER_LEFT:
+    case TGA_LOWER_RIGHT:
+    default:
+        y = row;
+        break;
+
+    }
+
+    if( top_down ) {
+        y = h - 1 - y;
+    }
+
+    return( y );
+
+}
 
 
-        case RLP:
-            repcount++;
 
-            if( column == 0 ) {
-                // finish off rlp.
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-                break;
-            }
 
-            if( repcount == 127 ) {
-                // finish off rlp.
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-                break;
-            }
+static ubyte * tga_row_dest( ubyte * dat, ubyte img_desc, uint32 y, uint32 w, 
+                            uint32 format, size_t stride, int32 * dst_step ) {
 
-            if( nc != oc ) {
-                // finish off rlp
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
+    // find where memory row y starts and which way along it to step.
+
+    ubyte * dst = dat + (size_t)y * stride;
+
+    if( img_desc & 0x10 ) {
+        // right-to-left rows.
+        dst += (w - 1) * format;
+        *dst_step = -(int32)format;
+    } else {
+        *dst_step = format;
+    }
+
+    return( dst );
+
+}
+
+
+
+
+static int tga_converter_init( tga_converter * conv, ubyte bytes_per_pix, ubyte bpp_in, 
+                              ubyte alphabits, const ubyte * colormap, uint32 cmap_first, 
+                              uint32 cmap_length, ubyte cmap_bytes_entry, uint32 format ) {
+
+    // pick the row kernel for this file's pixels.  returns 0 if there's no 
+    // memory for its lookup table.
+
+    uint32 i;
+    uint32 j;
+    uint32 pixel;
+    ubyte pix[2];
+
+    conv->bytes_per_pix    = bytes_per_pix;
+    conv->bpp_in           = bpp_in;
+    conv->alphabits        = alphabits;
+    conv->format           = format;
+    conv->lut              = NULL;
+    conv->lut_entries      = 0;
+    conv->ssse3            = 0;
+
+#ifdef TGA_SSE2
+    conv->ssse3 = tga_cpu_has_ssse3();
 #endif
-                state = NONE;
+
+    if( colormap != NULL ) {
+
+        // convert each colormap entry once, so a pixel is just a lookup.  the 
+        // table covers every 1 or 2 byte index; indices the colormap doesn't 
+        // have come out black and transparent.
+        conv->kernel = TGA_KERNEL_PALETTE;
+        conv->lut_entries = bytes_per_pix == 1 ? 256 : bytes_per_pix == 2 ? 65536 : cmap_first + cmap_length;
+        conv->lut = (ubyte *)calloc( conv->lut_entries, 4 );
+        if( conv->lut == NULL ) {
+            return( 0 );
+        }
+
+        for( i = 0; i < cmap_length && cmap_first + i < conv->lut_entries; i++ ) {
+            pixel = 0;
+            for( j = 0; j < cmap_bytes_entry; j++ ) {
+                pixel += colormap[i * cmap_bytes_entry + j] << (8 * j);
             }
-            break;
+            pixel = tga_convert_color( pixel, bpp_in, alphabits, TGA_TRUECOLOR_32 );
+            conv->lut[(cmap_first + i) * 4 + 0] = (ubyte)(pixel & 0xFF);
+            conv->lut[(cmap_first + i) * 4 + 1] = (ubyte)((pixel >> 8) & 0xFF);
+            conv->lut[(cmap_first + i) * 4 + 2] = (ubyte)((pixel >> 16) & 0xFF);
+            conv->lut[(cmap_first + i) * 4 + 3] = (ubyte)((pixel >> 24) & 0xFF);
+        }
 
+    } else if( bpp_in == 32 && alphabits != 0 ) {
 
-        case RAWP:
-            repcount++;
+        conv->kernel = TGA_KERNEL_BGRA;
 
-            if( column == 0 ) {
-                // finish off rawp.
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
+    } else if( bpp_in == 32 || bpp_in == 24 ) {
+
+        conv->kernel = TGA_KERNEL_BGR;
+
+    } else if( bytes_per_pix == 2 && (bpp_in == 15 || bpp_in == 16) ) {
+
+        // there are only 64K possible pixels, so convert every one of them up 
+        // front exactly as the generic path would.
+        conv->kernel = TGA_KERNEL_LUT16;
+        conv->lut_entries = 65536;
+        conv->lut = (ubyte *)malloc( 65536 * 4 );
+        if( conv->lut == NULL ) {
+            return( 0 );
+        }
+
+        for( i = 0; i < 65536; i++ ) {
+            pix[0] = (ubyte)(i & 0xFF);
+            pix[1] = (ubyte)(i >> 8);
+            pixel = tga_get_pixel( pix, 2 );
+            pixel = tga_convert_color( pixel, bpp_in, alphabits, TGA_TRUECOLOR_32 );
+            conv->lut[i * 4 + 0] = (ubyte)(pixel & 0xFF);
+            conv->lut[i * 4 + 1] = (ubyte)((pixel >> 8) & 0xFF);
+            conv->lut[i * 4 + 2] = (ubyte)((pixel >> 16) & 0xFF);
+            conv->lut[i * 4 + 3] = (ubyte)((pixel >> 24) & 0xFF);
+        }
+
+    } else {
+
+        conv->kernel = TGA_KERNEL_GENERIC;
+
+    }
+
+    return( 1 );
+
+}
+
+
+
+
+static void tga_converter_free( tga_converter * conv ) {
+
+    free( conv->lut );
+    conv->lut = NULL;
+
+}
+
+
+
+
+static void tga_convert_row( const tga_converter * conv, const ubyte * src, ubyte * dst, 
+                            uint32 w, int32 dst_step ) {
+
+    // convert one row of file pixels to RGB(A), premultiplying alpha.
+    // the SIMD kernels take whole blocks of a row going left to right into
+    // 32-bit pixels, the plain loops finish whatever is left.
+    //
+    // (c * a) / 255 is bit-for-bit what tga_convert_color's float premultiply gives.
+
+    uint32 x = 0;
+    uint32 pixel;
+    uint32 a;
+    uint32 j;
+    uint32 index;
+    uint32 format = conv->format;
+    ubyte bytes_per_pix = conv->bytes_per_pix;
+    const ubyte * entry;
+
+    switch( conv->kernel ) {
+
+    case TGA_KERNEL_BGRA:
+
+#ifdef TGA_SSE2
+        if( dst_step == 4 ) {
+            x = tga_convert_bgra_sse2( src, dst, w );
+            src += x * 4;
+            dst += x * 4;
+        }
 #endif
-                }
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                state = NONE;
-                break;
+
+        for( ; x < w; x++, src += 4, dst += dst_step ) {
+            a = src[3];
+            dst[0] = (ubyte)((src[2] * a) / 255);
+            dst[1] = (ubyte)((src[1] * a) / 255);
+            dst[2] = (ubyte)((src[0] * a) / 255);
+            if( format == TGA_TRUECOLOR_32 ) {
+                dst[3] = (ubyte)a;
             }
+        }
+        break;
 
-            if( repcount == 127 ) {
-                // finish off rawp.
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
+    case TGA_KERNEL_BGR:
+
+#ifdef TGA_SSE2
+        if( dst_step == 4 ) {
+            if( bytes_per_pix == 4 ) {
+                x = tga_convert_bgrx_sse2( src, dst, w );
+            } else if( conv->ssse3 ) {
+                x = tga_convert_bgr_ssse3( src, dst, w );
+            }
+            src += x * bytes_per_pix;
+            dst += x * 4;
+        }
 #endif
-                }
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                state = NONE;
-                break;
+
+        // alpha is forced to full, so no premultiply needed.
+        for( ; x < w; x++, src += bytes_per_pix, dst += dst_step ) {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+            if( format == TGA_TRUECOLOR_32 ) {
+                dst[3] = 0xFF;
             }
+        }
+        break;
+
+    case TGA_KERNEL_PALETTE:
 
-            if( nc == oc ) {
-                // finish off rawp
-                repcount--;
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                
-                // start new rlp
-                repcount = 0;
-                state = RLP;
+        for( ; x < w; x++, src += bytes_per_pix, dst += dst_step ) {
+            switch( bytes_per_pix ) {
+            case 1:
+                index = src[0];
+                break;
+            case 2:
+                index = src[0] | (src[1] << 8);
+                break;
+            default:
+                index = tga_get_pixel( src, bytes_per_pix );
+                if( index >= conv->lut_entries ) {
+                    memset( dst, 0, format );
+                    continue;
+                }
                 break;
             }
+            entry = conv->lut + (index << 2);
+            dst[0] = entry[0];
+            dst[1] = entry[1];
+            dst[2] = entry[2];
+            if( format == TGA_TRUECOLOR_32 ) {
+                dst[3] = entry[3];
+            }
+        }
+        break;
 
-            // continue making rawp
-            for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
+    case TGA_KERNEL_LUT16:
+
+        for( ; x < w; x++, src += 2, dst += dst_step ) {
+            entry = conv->lut + ((src[0] | (src[1] << 8)) << 2);
+            dst[0] = entry[0];
+            dst[1] = entry[1];
+            dst[2] = entry[2];
+            if( format == TGA_TRUECOLOR_32 ) {
+                dst[3] = entry[3];
             }
+        }
+        break;
 
-            break;
+    default:
 
+        for( ; x < w; x++, src += bytes_per_pix, dst += dst_step ) {
+            pixel = tga_get_pixel( src, bytes_per_pix );
+            pixel = tga_convert_color( pixel, conv->bpp_in, conv->alphabits, format );
+            for( j = 0; j < format; j++ ) {
+                dst[j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
+            }
         }
-       
+        break;
 
     }
 
+}
 
-    // clean up state.
 
-    switch( state ) {
 
-    case INIT:
-        break;
 
-    case NONE:
-        // write the last 2 pixels in a raw packet.
-        fwrite( &one, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&nc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &nc, format, 1, tga );
-#endif
-        break;
+#ifdef TGA_SSE2
 
-    case RLP:
-        repcount++;
-        repcount |= 0x80;
-        fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-        break;
+static int tga_cpu_has_ssse3( void ) {
 
-    case RAWP:
-        repcount++;
-        for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-            rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid( regs, 1 );
+    return( (regs[2] >> 9) & 1 );
 #else
-            rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
+    return( __builtin_cpu_supports( "ssse3" ) );
 #endif
-        }
-        fwrite( &repcount, 1, 1, tga );
-        fwrite( rawbuf, (repcount + 1) * 3, 1, tga );
-        break;
 
-    }
+}
 
 
-    // close the file.
-    fclose( tga );
 
-    free( rawbuf );
 
-    return( 1 );
+static uint32 tga_convert_bgrx_sse2( const ubyte * src, ubyte * dst, uint32 w ) {
+
+    // opaque 32-bit, four pixels at a time:  swap blue and red, force alpha 
+    // to full.  returns how many pixels were done.
+
+    const __m128i green = _mm_set1_epi32( 0x0000FF00 );
+    const __m128i low   = _mm_set1_epi32( 0x000000FF );
+    const __m128i alpha = _mm_set1_epi32( (int)0xFF000000 );
+    __m128i p;
+    __m128i q;
+    uint32 x;
+
+    for( x = 0; x + 4 <= w; x += 4 ) {
+        p = _mm_loadu_si128( (const __m128i *)(src + x * 4) );
+        q = _mm_or_si128( _mm_and_si128( p, green ), alpha );
+        q = _mm_or_si128( q, _mm_and_si128( _mm_srli_epi32( p, 16 ), low ) );
+        q = _mm_or_si128( q, _mm_slli_epi32( _mm_and_si128( p, low ), 16 ) );
+        _mm_storeu_si128( (__m128i *)(dst + x * 4), q );
+    }
+
+    return( x );
 
 }
 
 
 
 
+static __m128i tga_premultiply_sse2( __m128i px ) {
 
-/*************************************************************************************************/
+    // two BGRA pixels widened to 16 bits a channel become premultiplied RGBA:
+    // each color times alpha over 255, alpha times 255 over 255.
 
+    const __m128i color = _mm_setr_epi16( -1, -1, -1, 0, -1, -1, -1, 0 );
+    const __m128i full  = _mm_setr_epi16( 0, 0, 0, 255, 0, 0, 0, 255 );
+    const __m128i one   = _mm_set1_epi16( 1 );
+    __m128i a;
 
+    px = _mm_shufflelo_epi16( px, _MM_SHUFFLE( 3, 0, 1, 2 ) );
+    px = _mm_shufflehi_epi16( px, _MM_SHUFFLE( 3, 0, 1, 2 ) );
 
+    a = _mm_shufflelo_epi16( px, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+    a = _mm_shufflehi_epi16( a, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+    a = _mm_or_si128( _mm_and_si128( a, color ), full );
 
+    px = _mm_mullo_epi16( px, a );
 
-static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
-                                   uint32 w, uint32 h, uint32 pixel, uint32 format ) {
+    // (t + 1 + (t >> 8)) >> 8 is exactly t / 255 for t up to 255 * 255.
+    return( _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( px, one ), _mm_srli_epi16( px, 8 ) ), 8 ) );
 
-    // write the pixel to the data regarding how the
-    // header says the data is ordered.
+}
 
-    uint32 j;
-    uint32 x, y;
-    uint32 addy;
 
-    switch( (img_spec & 0x30) >> 4 ) {
 
-    case TGA_LOWER_RIGHT:
-        x = w - 1 - (number % w);
-        y = number / h;
-        break;
 
-    case TGA_UPPER_LEFT:
-        x = number % w;
-        y = h - 1 - (number / w);
-        break;
+static uint32 tga_convert_bgra_sse2( const ubyte * src, ubyte * dst, uint32 w ) {
 
-    case TGA_UPPER_RIGHT:
-        x = w - 1 - (number % w);
-        y = h - 1 - (number / w);
-        break;
+    // 32-bit with alpha, four pixels at a time.  returns how many were done.
 
-    case TGA_LOWER_LEFT:
-    default:
-        x = number % w;
-        y = number / w;
-        break;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i p;
+    __m128i lo;
+    __m128i hi;
+    uint32 x;
 
+    for( x = 0; x + 4 <= w; x += 4 ) {
+        p = _mm_loadu_si128( (const __m128i *)(src + x * 4) );
+        lo = tga_premultiply_sse2( _mm_unpacklo_epi8( p, zero ) );
+        hi = tga_premultiply_sse2( _mm_unpackhi_epi8( p, zero ) );
+        _mm_storeu_si128( (__m128i *)(dst + x * 4), _mm_packus_epi16( lo, hi ) );
     }
 
-    addy = (y * w + x) * format;
-    for( j = 0; j < format; j++ ) {
-        dat[addy + j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
+    return( x );
+
+}
+
+
+
+
+TGA_TARGET_SSSE3 static uint32 tga_convert_bgr_ssse3( const ubyte * src, ubyte * dst, uint32 w ) {
+
+    // 24-bit to 32-bit, four pixels at a time.  each load takes 16 bytes 
+    // for 12 bytes of pixels, so stop while a whole load still fits the row.
+    // returns how many pixels were done.
+
+    const __m128i order = _mm_setr_epi8( 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1 );
+    const __m128i alpha = _mm_set1_epi32( (int)0xFF000000 );
+    __m128i p;
+    uint32 x;
+
+    for( x = 0; x + 6 <= w; x += 4 ) {
+        p = _mm_loadu_si128( (const __m128i *)(src + x * 3) );
+        _mm_storeu_si128( (__m128i *)(dst + x * 4), _mm_or_si128( _mm_shuffle_epi8( p, order ), alpha ) );
     }
-    
+
+    return( x );
+
 }
 
+#endif
+
 
 
 
-static uint32 tga_get_pixel( FILE * tga, ubyte bytes_per_pix, 
-                            ubyte * colormap, ubyte cmap_bytes_entry ) {
+static uint32 tga_get_pixel( const ubyte * src, ubyte bytes_per_pix ) {
     
     /* get the image data value out */
 
-    uint32 tmp_col;
     uint32 tmp_int32;
-    ubyte tmp_byte;
 
     uint32 j;
 
     tmp_int32 = 0;
     for( j = 0; j < bytes_per_pix; j++ ) {
-        if( fread( &tmp_byte, 1, 1, tga ) < 1 ) {
-            tmp_int32 = 0;
-        } else {
-            tmp_int32 += tmp_byte << (j * 8);
-        }
+        tmp_int32 += src[j] << (j * 8);
     }
     
     /* byte-order correct the thing */
@@ -1048,18 +2575,154 @@ static uint32 tga_get_pixel( FILE * tga, ubyte bytes_per_pix,
         
     }
     
-    if( colormap != NULL ) {
-        /* need to look up value to get real color */
-        tmp_col = 0;
-        for( j = 0; j < cmap_bytes_entry; j++ ) {
-            tmp_col += colormap[cmap_bytes_entry * tmp_int32 + j] << (8 * j);
+    return( tmp_int32 );
+    
+}
+
+
+
+
+static void tga_encode_pixel( const ubyte * src, ubyte * out, uint32 format ) {
+
+    // RGB(A) in memory to BGR(A) in the file, un-premultiplying alpha.
+
+    float red, green, blue, alpha;
+
+    switch( format ) {
+
+    case TGA_TRUECOLOR_24:
+        out[0] = src[2];
+        out[1] = src[1];
+        out[2] = src[0];
+        break;
+
+    case TGA_TRUECOLOR_32:
+
+        /* need to un-premultiply alpha.. */
+
+        red     = src[0] / 255.0f;
+        green   = src[1] / 255.0f;
+        blue    = src[2] / 255.0f;
+        alpha   = src[3] / 255.0f;
+
+        if( alpha > 0.0001 ) {
+            red /= alpha;
+            green /= alpha;
+            blue /= alpha;
+        }
+
+        /* clamp to 1.0f */
+
+        red = red > 1.0f ? 255.0f : red * 255.0f;
+        green = green > 1.0f ? 255.0f : green * 255.0f;
+        blue = blue > 1.0f ? 255.0f : blue * 255.0f;
+        alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
+
+        out[0] = (ubyte)blue;
+        out[1] = (ubyte)green;
+        out[2] = (ubyte)red;
+        out[3] = (ubyte)alpha;
+        break;
+
+    }
+
+}
+
+
+
+
+static void tga_encode_row( const ubyte * src, ubyte * out, uint32 w, uint32 format ) {
+
+    uint32 x;
+
+    for( x = 0; x < w; x++ ) {
+
+        if( x > 0 && tga_pixel_word( src + x * format, format ) == 
+                     tga_pixel_word( src + (x - 1) * format, format ) ) {
+            // same pixel as the last one, no need to redo the divide.
+            memcpy( out + x * format, out + (x - 1) * format, format );
+        } else {
+            tga_encode_pixel( src + x * format, out + x * format, format );
+        }
+
+    }
+
+}
+
+
+
+
+static uint32 tga_rle_encode_row( const ubyte * pix, ubyte * out, uint32 w, uint32 format ) {
+
+    // pack one row of file-order pixels, returning the number of bytes written.
+    // packets never cross rows.  pixels are compared as whole words, not
+    // channel by channel.
+
+    ubyte * o = out;
+    uint32 x = 0;
+    uint32 start;
+    uint32 run;
+    uint32 cur;
+
+    while( x < w ) {
+
+        cur = tga_pixel_word( pix + x * format, format );
+
+        run = 1;
+        while( x + run < w && run < 128 && 
+               tga_pixel_word( pix + (x + run) * format, format ) == cur ) {
+            run++;
         }
+
+        if( run > 1 ) {
+
+            /* run length packet */
+            *o++ = (ubyte)(0x80 | (run - 1));
+            memcpy( o, pix + x * format, format );
+            o += format;
+            x += run;
+
+        } else {
+
+            /* raw packet -- goes until the next pair of equal pixels */
+            start = x++;
+            while( x < w && x - start < 128 ) {
+                cur = tga_pixel_word( pix + x * format, format );
+                if( x + 1 < w && tga_pixel_word( pix + (x + 1) * format, format ) == cur ) {
+                    break;
+                }
+                x++;
+            }
+
+            *o++ = (ubyte)(x - start - 1);
+            memcpy( o, pix + start * format, (x - start) * format );
+            o += (x - start) * format;
+
+        }
+
+    }
+
+    return( (uint32)(o - out) );
+
+}
+
+
+
+
+static uint32 tga_pixel_word( const ubyte * pix, uint32 format ) {
+
+    // a whole pixel as one word, for comparing.
+
+    uint32 word = 0;
+
+    if( format == TGA_TRUECOLOR_32 ) {
+        memcpy( &word, pix, 4 );
     } else {
-        tmp_col = tmp_int32;
+        memcpy( &word, pix, 3 );
     }
-    
-    return( tmp_col );
-    
+
+    return( word );
+
 }
 
 
@@ -1158,17 +2821,6 @@ static int16 ttohs( int16 val ) {
 }
 
 
-static int16 htots( int16 val ) {
-
-#ifdef WORDS_BIGENDIAN
-    return( ((val & 0xFF) << 8) + (val >> 8) );
-#else
-    return( val );
-#endif
-
-}
-
-
 static int32 ttohl( int32 val ) {
 
 #ifdef WORDS_BIGENDIAN
@@ -1183,16 +2835,3 @@ static int32 ttohl( int32 val ) {
 }
 
 
-static int32 htotl( int32 val ) {
-
-#ifdef WORDS_BIGENDIAN
-    return( ((val & 0x000000FF) << 24) +
-            ((val & 0x0000FF00) << 8)  +
-            ((val & 0x00FF0000) >> 8)  +
-            ((val & 0xFF000000) >> 24) );
-#else
-    return( val );
-#endif 
-
-}
-
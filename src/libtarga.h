@@ -1,6 +1,8 @@
 #ifndef _libtarga_h_
 #define _libtarga_h_
 
+#include <stddef.h>
+
 
 /* uncomment this line if you're compiling on a big-endian machine */
 /* #define WORDS_BIGENDIAN */
@@ -63,15 +65,38 @@
 /*
    Image data will start in the low-left corner
    of the image.
+
+   OR TGA_ORIGIN_UPPER into the format to get rows
+   starting in the upper-left corner instead.
+*/
+
+#define TGA_ORIGIN_UPPER      (0x100)
+
+
+/*
+   What tga_probe finds in a file's header.
 */
 
+typedef struct {
+    int  width;
+    int  height;
+    int  pix_depth;         /* bits per pixel as stored -- colormap indices for paletted images */
+    int  cmap_entry_size;   /* bits per colormap entry, 0 if there is no colormap */
+    int  alphabits;         /* attribute (alpha) bits per pixel */
+    int  paletted;
+    int  grayscale;
+    int  rle;
+    int  origin_upper;      /* rows are stored top to bottom */
+    char id[256];           /* the image id, nul terminated */
+} tga_info;
+
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 
-/* Error handling routines */
+/* Error handling routines  --  the last error is shared by all threads, see the _r calls below */
 int             tga_get_last_error();
 const char *    tga_error_string( int error_code );
 
@@ -81,11 +106,99 @@ void * tga_create( int width, int height, unsigned int format );
 void * tga_load( const char * file, int * width, int * height, unsigned int format );
 
 
-/* Writing images to file  --  a return of 1 indicates success, 0 indicates error*/
+/* Probing images  --  reads only the header and image id.  A return of 1 indicates success, 0 error */
+int    tga_probe( const char * file, tga_info * info );
+
+
+/* Mapping images  --  uncompressed truecolor files only.  tga_map returns NULL if the
+   file can't be mapped (use tga_load then); tga_map_read converts the mapped pixels
+   into dat, which must hold width * height * format bytes, and returns 1 on success. */
+void * tga_map( const char * file, int * width, int * height );
+int    tga_map_read( void * map, unsigned char * dat, unsigned int format );
+void   tga_unmap( void * map );
+
+
+/* Writing images to file  --  a return of 1 indicates success, 0 indicates error, in
+   which case no file is left behind */
 int tga_write_raw( const char * file, int width, int height, unsigned char * dat, unsigned int format );
 int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format );
 
 
+/* Reentrant versions of the above  --  instead of setting the last error, each call
+   stores its own error code (0 on success) in *error, which must not be NULL.
+   Safe to call from several threads at once. */
+void * tga_create_r( int width, int height, unsigned int format, int * error );
+void * tga_load_r( const char * file, int * width, int * height, unsigned int format, int * error );
+int    tga_probe_r( const char * file, tga_info * info, int * error );
+void * tga_map_r( const char * file, int * width, int * height, int * error );
+int    tga_map_read_r( void * map, unsigned char * dat, unsigned int format, int * error );
+int    tga_write_raw_r( const char * file, int width, int height, unsigned char * dat, 
+                        unsigned int format, int * error );
+int    tga_write_rle_r( const char * file, int width, int height, unsigned char * dat, 
+                        unsigned int format, int * error );
+
+
+/* In-memory images  --  tga_decode_mem is tga_load_r on a buffer holding a whole targa
+   file.  tga_encode_mem returns a malloc'd buffer holding a whole targa file, raw or
+   run-length encoded, and its length in *size; free it with free().  NULL indicates
+   an error.  Both are reentrant. */
+void * tga_decode_mem( const void * buf, size_t size, int * width, int * height, 
+                       unsigned int format, int * error );
+void * tga_encode_mem( int width, int height, unsigned char * dat, unsigned int format, 
+                       int rle, size_t * size, int * error );
+
+
+/* Padded rows  --  the same as tga_map_read_r, tga_write_raw_r/tga_write_rle_r and 
+   tga_encode_mem, but rows of dat start stride bytes apart instead of width * format, 
+   for images whose rows are padded.  A stride of 0 means packed rows.  All are 
+   reentrant. */
+int    tga_map_read_stride_r( void * map, unsigned char * dat, size_t stride, 
+                              unsigned int format, int * error );
+int    tga_write_stride_r( const char * file, int width, int height, unsigned char * dat, 
+                           size_t stride, unsigned int format, int rle, int * error );
+void * tga_encode_mem_stride( int width, int height, unsigned char * dat, size_t stride, 
+                              unsigned int format, int rle, size_t * size, int * error );
+
+
+/* Decoding into your own memory  --  the same as tga_load_r and tga_decode_mem, but the 
+   pixels go where alloc says.  Once the header is read alloc is called with the image's 
+   width and height and ctx; it returns room for the pixels and sets *stride to the 
+   bytes from one of its rows to the next, or leaves it 0 for packed rows.  If it 
+   returns NULL the load fails.  The buffer it gave is returned, and belongs to the 
+   caller.  Both are reentrant. */
+typedef void * (*tga_alloc_func)( int width, int height, size_t * stride, void * ctx );
+
+void * tga_load_alloc_r( const char * file, int * width, int * height, unsigned int format, 
+                         tga_alloc_func alloc, void * ctx, int * error );
+void * tga_decode_mem_alloc( const void * buf, size_t size, int * width, int * height, 
+                             unsigned int format, tga_alloc_func alloc, void * ctx, int * error );
+
+
+/* Streaming  --  for images too big to hold whole.  tga_band_open_r returns a handle 
+   for tga_band_read_r, which fills dat with the next band of up to rows rows in the 
+   same layout tga_load_r would give, returning how many it read (0 once the image is 
+   done).  tga_band_close releases the handle.  tga_band_create_r starts a raw or 
+   run-length encoded file that tga_band_write_r adds bands of rows to, in the order 
+   the format says; rows are written as they come, so memory stays at a row or two.
+   tga_band_finish_r must be called to close the file -- it fails, padding the image
+   with empty rows, if fewer than height rows were written.  The _stride versions take
+   rows of dat stride bytes apart, as the padded row calls above do.  A handle must 
+   only be used by one thread at a time. */
+void * tga_band_open_r( const char * filename, int * width, int * height, 
+                        unsigned int format, int * error );
+int    tga_band_read_r( void * band_reader, unsigned char * dat, int rows, int * error );
+int    tga_band_read_stride_r( void * band_reader, unsigned char * dat, size_t stride, 
+                               int rows, int * error );
+void   tga_band_close( void * band_reader );
+
+void * tga_band_create_r( const char * file, int width, int height, unsigned int format, 
+                          int rle, int * error );
+int    tga_band_write_r( void * band_writer, unsigned char * dat, int rows, int * error );
+int    tga_band_write_stride_r( void * band_writer, unsigned char * dat, size_t stride, 
+                                int rows, int * error );
+int    tga_band_finish_r( void * band_writer, int * error );
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,74 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PixelPoolTest.cpp
+//
+//      Checks the pool TargaImage::Alloc_Pixels hands pixel buffers out
+//  from.  The sizes are picked against the pool's 512MB limit on spare
+//  blocks; the memory is never touched, so little of it is ever faulted in.
+//  Returns nonzero if a check fails.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TargaImage.h"
+#include <stdlib.h>
+#include <iostream>
+
+using namespace std;
+
+const size_t    c_MB                    = (size_t)1024 * 1024;
+
+static int s_failures = 0;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Report a failed check.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Check(bool bPassed, const char* sWhat)
+{
+	if (bPassed)
+		return;
+
+	cout << "FAILED:  " << sWhat << endl;
+	s_failures++;
+}// Check
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      A block taken back out of the pool leaves its bucket empty.  Giving
+//  back enough to go over the limit must then evict from the buckets that
+//  still hold blocks, and keep the one just given.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Test_Evict_After_Take()
+{
+	unsigned char* big = TargaImage::Alloc_Pixels(400 * c_MB);
+	unsigned char* small = TargaImage::Alloc_Pixels(200 * c_MB);
+
+	// empty the big bucket again
+	TargaImage::Free_Pixels(big);
+	unsigned char* again = TargaImage::Alloc_Pixels(400 * c_MB);
+	Check(again == big, "a freed block is reused for the same size");
+
+	// the small block is on hand; the big one doesn't fit beside it
+	TargaImage::Free_Pixels(small);
+	TargaImage::Free_Pixels(again);
+
+	unsigned char* kept = TargaImage::Alloc_Pixels(400 * c_MB);
+	Check(kept == big, "the block given last is kept over the one evicted");
+	TargaImage::Free_Pixels(kept);
+}// Test_Evict_After_Take
+
+
+int main()
+{
+	Test_Evict_After_Take();
+
+	if (s_failures)
+		return EXIT_FAILURE;
+
+	cout << "PixelPoolTest passed" << endl;
+	return EXIT_SUCCESS;
+}